@@ -0,0 +1,437 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/function.hpp>
+#include <boost/lexical_cast.hpp>
+#include <opencv2/opencv.hpp>
+#include <lmdb.h>
+#include <glog/logging.h>
+#include <gflags/gflags.h>
+
+#include "caffe/proto/caffe.pb.h"
+#include "bmp_decoder.h"
+#include "blob_kernels.h"
+#include "datum_encoder.h"
+#include "directory_walker.h"
+#include "labels.h"
+#include "lenet_image.h"
+#include "lmdb_writer.h"
+#include "resample.h"
+#include "stage_timer.h"
+#include "synthetic_corpus.h"
+#include "thread_pool.h"
+
+// gflags 2.1 moved everything from google:: to gflags::
+#ifndef GFLAGS_GFLAGS_H_
+namespace gflags = google;
+#endif
+
+DEFINE_string(work_dir, "bmp_converter_bench", "Directory for the corpus and the benchmark databases, "
+                                               "emptied first");
+DEFINE_uint64(seed, 1, "Seed of the synthetic corpus, the same seed gives the same files");
+DEFINE_int32(images, 2000, "Images in the corpus");
+DEFINE_string(bit_depths, "1,4,8,24,32", "Bits per pixel of the bmp files, dealt to the images in turn");
+DEFINE_int32(min_side, 24, "Smallest image side, in pixels");
+DEFINE_int32(max_side, 128, "Largest image side, in pixels");
+DEFINE_double(blank_fraction, 0.02, "Share of images with no character");
+DEFINE_double(noise_fraction, 0.2, "Share of images with specks around the character");
+DEFINE_string(layout, "skewed", "Directory layout of the corpus: flat, balanced or skewed");
+DEFINE_int32(directories, 64, "Directories of the balanced and skewed layouts");
+DEFINE_int32(size, 28, "Side of the network input image");
+DEFINE_double(pad, 1.5, "Canvas side relative to the larger side of the character");
+DEFINE_int32(repeat, 5, "Runs of every in-memory benchmark, the fastest one is reported");
+DEFINE_int32(lmdb_rounds, 10, "Times the images are written in the lmdb benchmark");
+DEFINE_string(json, "", "Write the results there instead of stdout");
+
+using std::string;
+using std::vector;
+
+struct BENCH_RESULT
+{
+    string name;
+    uint64_t items, bytes;
+    double seconds;
+};
+
+struct BENCH_INPUT // corpus loaded and processed once, benchmarks reuse it
+{
+    vector<string> paths;
+    vector< vector<uchar> > files;
+    vector<int> bit_depths;               // per file
+    vector< vector<uchar> > gray;         // decoded, dense rows
+    vector< vector<uchar> > inverted;     // gray inverted, light character on black as the converter measures it
+    vector<int> widths, heights;
+    vector< vector<uchar> > lenet;        // per image with a character
+    vector<char> labels;                  // per lenet image
+};
+
+static double secondsOf(const boost::function<void()>& run, int repeat) // fastest of `repeat` runs
+{
+    double best = 0;
+    for (int r = 0; r < repeat; ++r)
+    {
+        uint64_t start = monotonicNanoseconds();
+        run();
+        double seconds = (monotonicNanoseconds() - start)*1e-9;
+        if (r == 0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+static void addResult(vector<BENCH_RESULT>& results, const string& name, uint64_t items, uint64_t bytes,
+                      double seconds)
+{
+    BENCH_RESULT result;
+    result.name = name;
+    result.items = items;
+    result.bytes = bytes;
+    result.seconds = seconds;
+    results.push_back(result);
+    LOG(INFO) << name << ": " << items << " items in " << seconds << " s" << std::endl;
+}
+
+static void countFile(boost::atomic<size_t>* files, const string&)
+{
+    files->fetch_add(1, boost::memory_order_relaxed);
+}
+
+static void scanCorpus(const string& root)
+{
+    boost::atomic<size_t> files(0);
+    WORK_STEALING_POOL pool;
+    DIRECTORY_WALKER walker(pool, boost::bind(countFile, &files, _1));
+    walker.walk(root);
+    pool.wait();
+}
+
+static void readCorpus(BENCH_INPUT* input)
+{
+    for (size_t i = 0; i < input->paths.size(); ++i)
+    {
+        std::ifstream in(input->paths[i].c_str(), std::ios::binary);
+        input->files[i].assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+}
+
+static void decodeNative(BENCH_INPUT* input, int bpp)
+{
+    int width, height;
+    for (size_t i = 0; i < input->files.size(); ++i)
+        if (input->bit_depths[i] == bpp)
+            CHECK(decodeBmpGray(&input->files[i][0], input->files[i].size(), input->gray[i], width, height))
+                << input->paths[i] << " cannot be decoded";
+}
+
+static void decodeOpenCV(BENCH_INPUT* input)
+{
+    for (size_t i = 0; i < input->files.size(); ++i)
+    {
+        CHECK(!cv::imdecode(cv::Mat(1, input->files[i].size(), CV_8UC1, &input->files[i][0]),
+                            CV_LOAD_IMAGE_GRAYSCALE).empty()) << input->paths[i] << " cannot be decoded";
+    }
+}
+
+static void findBlobs(BENCH_INPUT* input) // the measuring pass of placeCharacter, without its in-place inversion
+{
+    cv::Rect bounds;
+    cv::Point2f centroid;
+    for (size_t i = 0; i < input->inverted.size(); ++i)
+    {
+        cv::Mat img(input->heights[i], input->widths[i], CV_8UC1, &input->inverted[i][0]);
+        findBlobParams(img, bounds, centroid);
+    }
+}
+
+static void convertToLeNet(BENCH_INPUT* input, bool keep) // what preprocessImage does for one size
+{
+    RESAMPLE_SCRATCH scratch;
+    vector<uchar> work, lenet(FLAGS_size*FLAGS_size);
+    for (size_t i = 0; i < input->gray.size(); ++i)
+    {
+        work.assign(input->gray[i].begin(), input->gray[i].end()); // placeCharacter inverts in place
+        cv::Mat img(input->heights[i], input->widths[i], CV_8UC1, &work[0]);
+        CANVAS_PLACEMENT placement;
+        if (placeCharacter(img, FLAGS_pad, placement) == -1)
+            continue;
+        cropPadResize(img.ptr(), img.step, placement, FLAGS_size, &lenet[0], scratch);
+        if (keep)
+        {
+            input->lenet.push_back(lenet);
+            input->labels.push_back(labelToClass(getLabelChar(input->paths[i]), ALL_CLASSES));
+        }
+    }
+}
+
+static volatile int label_sink; // the labels are used, so the loop is not optimised away
+
+static void getLabels(const BENCH_INPUT* input, int rounds)
+{
+    int sum = 0;
+    for (int r = 0; r < rounds; ++r)
+        for (size_t i = 0; i < input->paths.size(); ++i)
+            sum += getLabel(input->paths[i], ALL_CLASSES);
+    label_sink = sum;
+}
+
+static DATUM_SHAPE shapeOf(char label)
+{
+    DATUM_SHAPE shape;
+    shape.channels = 1;
+    shape.height = FLAGS_size;
+    shape.width = FLAGS_size;
+    shape.label = label;
+    return shape;
+}
+
+static void serializeProtobuf(const BENCH_INPUT* input, uint64_t* bytes)
+{
+    caffe::Datum datum;
+    string value;
+    *bytes = 0;
+    for (size_t i = 0; i < input->lenet.size(); ++i)
+    {
+        datum.set_channels(1);
+        datum.set_height(FLAGS_size);
+        datum.set_width(FLAGS_size);
+        datum.set_data(&input->lenet[i][0], input->lenet[i].size());
+        datum.set_label(input->labels[i]);
+        datum.SerializeToString(&value);
+        *bytes += value.size();
+    }
+}
+
+static void serializeEncoder(const BENCH_INPUT* input, uint64_t* bytes)
+{
+    vector<uchar> value;
+    *bytes = 0;
+    for (size_t i = 0; i < input->lenet.size(); ++i)
+    {
+        DATUM_SHAPE shape = shapeOf(input->labels[i]);
+        value.resize(datumWireSize(shape, input->lenet[i].size()));
+        encodeDatum(shape, &input->lenet[i][0], input->lenet[i].size(), &value[0]);
+        *bytes += value.size();
+    }
+}
+
+struct BENCH_DB
+{
+    MDB_env* env;
+    MDB_dbi dbi;
+
+    explicit BENCH_DB(const string& db_path)
+    {
+        boost::filesystem::remove_all(db_path);
+        boost::filesystem::create_directories(db_path);
+        MDB_txn* txn;
+        CHECK_EQ(mdb_env_create(&env), MDB_SUCCESS) << "mdb_env_create failed";
+        CHECK_EQ(mdb_env_set_mapsize(env, 1099511627776), MDB_SUCCESS) << "mdb_env_set_mapsize failed"; // 1TB
+        CHECK_EQ(mdb_env_open(env, db_path.c_str(), 0, 0664), MDB_SUCCESS) << "mdb_env_open failed";
+        CHECK_EQ(mdb_txn_begin(env, NULL, 0, &txn), MDB_SUCCESS) << "mdb_txn_begin failed";
+        CHECK_EQ(mdb_open(txn, NULL, 0, &dbi), MDB_SUCCESS) << "mdb_open failed";
+        CHECK_EQ(mdb_txn_commit(txn), MDB_SUCCESS) << "mdb_txn_commit failed";
+    }
+    ~BENCH_DB()
+    {
+        mdb_close(env, dbi);
+        mdb_env_close(env);
+    }
+};
+
+static void pushDatum(LMDB_WRITER& writer, long item_no, const uchar* pixels, char label)
+{
+    const int kMaxKeyLength = 10;
+    char key_cstr[kMaxKeyLength];
+    snprintf(key_cstr, kMaxKeyLength, "%08d", static_cast<int>(item_no));
+    DB_RECORD* record = new DB_RECORD();
+    record->key = key_cstr;
+    record->pixels.assign(pixels, pixels + FLAGS_size*FLAGS_size);
+    record->datum = true;
+    record->shape = shapeOf(label);
+    record->item_no = item_no;
+    writer.push(record);
+}
+
+static void writeLmdb(const BENCH_INPUT* input, const string& db_path, uint64_t* records)
+{
+    BENCH_DB db(db_path);
+    LMDB_WRITER writer(db.env, db.dbi, WRITER_OPTIONS());
+    long item_no = 0;
+    for (int r = 0; r < FLAGS_lmdb_rounds; ++r)
+        for (size_t i = 0; i < input->lenet.size(); ++i)
+            pushDatum(writer, item_no++, &input->lenet[i][0], input->labels[i]);
+    writer.finish();
+    *records = writer.written();
+    CHECK(checkStoredDatums(db.env, db.dbi, 1, FLAGS_size) || !*records) << db_path << ": nothing was stored";
+}
+
+static void convertEndToEnd(const BENCH_INPUT* input, const string& db_path, uint64_t* records, uint64_t* bytes)
+{
+    BENCH_DB db(db_path);
+    LMDB_WRITER writer(db.env, db.dbi, WRITER_OPTIONS());
+    RESAMPLE_SCRATCH scratch;
+    vector<uchar> file, gray, lenet(FLAGS_size*FLAGS_size);
+    long item_no = 0;
+    *bytes = 0;
+    for (size_t i = 0; i < input->paths.size(); ++i)
+    {
+        std::ifstream in(input->paths[i].c_str(), std::ios::binary);
+        file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        *bytes += file.size();
+        int width, height;
+        cv::Mat img;
+        if (decodeBmpGray(&file[0], file.size(), gray, width, height))
+            img = cv::Mat(height, width, CV_8UC1, &gray[0]);
+        else
+            img = cv::imdecode(cv::Mat(1, file.size(), CV_8UC1, &file[0]), CV_LOAD_IMAGE_GRAYSCALE);
+        CANVAS_PLACEMENT placement;
+        if (img.empty() || placeCharacter(img, FLAGS_pad, placement) == -1)
+            continue;
+        cropPadResize(img.ptr(), img.step, placement, FLAGS_size, &lenet[0], scratch);
+        pushDatum(writer, item_no++, &lenet[0], labelToClass(getLabelChar(input->paths[i]), ALL_CLASSES));
+    }
+    writer.finish();
+    *records = writer.written();
+    CHECK(checkStoredDatums(db.env, db.dbi, 1, FLAGS_size) || !*records) << db_path << ": nothing was stored";
+}
+
+static void writeJson(std::ostream& out, const vector<BENCH_RESULT>& results)
+{
+    out << "{\n"
+        << "  \"seed\": " << FLAGS_seed << ",\n"
+        << "  \"images\": " << FLAGS_images << ",\n"
+        << "  \"layout\": \"" << FLAGS_layout << "\",\n"
+        << "  \"bit_depths\": \"" << FLAGS_bit_depths << "\",\n"
+        << "  \"size\": " << FLAGS_size << ",\n"
+        << "  \"blob_kernel\": \"" << blobKernelName() << "\",\n"
+        << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BENCH_RESULT& r = results[i];
+        double seconds = r.seconds > 0 ? r.seconds : 1e-9;
+        out << "    {\"name\": \"" << r.name << "\", \"items\": " << r.items << ", \"bytes\": " << r.bytes
+            << ", \"seconds\": " << r.seconds << ", \"items_per_sec\": " << r.items/seconds
+            << ", \"bytes_per_sec\": " << r.bytes/seconds << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char* argv[])
+{
+    gflags::SetUsageMessage("Usage: bmp_converter_bench [FLAGS]\n"
+                            "Generates a synthetic bmp corpus and times the conversion steps on it");
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+
+    CORPUS_OPTIONS options;
+    options.seed = FLAGS_seed;
+    options.images = FLAGS_images;
+    options.min_side = FLAGS_min_side;
+    options.max_side = FLAGS_max_side;
+    options.blank_fraction = FLAGS_blank_fraction;
+    options.noise_fraction = FLAGS_noise_fraction;
+    options.directories = FLAGS_directories;
+    CHECK(layoutFromName(FLAGS_layout, options.layout)) << "--layout should be flat, balanced or skewed";
+    vector<string> depth_list;
+    boost::algorithm::split(depth_list, FLAGS_bit_depths, boost::algorithm::is_any_of(","),
+                            boost::algorithm::token_compress_on);
+    options.bit_depths.clear();
+    for (size_t i = 0; i < depth_list.size(); ++i) // each depth is decoded and reported once
+    {
+        int bpp = atoi(depth_list[i].c_str());
+        if (std::find(options.bit_depths.begin(), options.bit_depths.end(), bpp) == options.bit_depths.end())
+            options.bit_depths.push_back(bpp);
+    }
+    CHECK_GT(FLAGS_images, 0) << "--images should be positive";
+    CHECK_GT(FLAGS_repeat, 0) << "--repeat should be positive";
+
+    string corpus = FLAGS_work_dir + "/corpus";
+    boost::filesystem::remove_all(FLAGS_work_dir);
+    vector<BENCH_RESULT> results;
+
+    BENCH_INPUT input;
+    uint64_t corpus_bytes = 0;
+    uint64_t start = monotonicNanoseconds();
+    input.paths = generateCorpus(corpus, options, &corpus_bytes);
+    addResult(results, "generate", input.paths.size(), corpus_bytes, (monotonicNanoseconds() - start)*1e-9);
+
+    size_t n = input.paths.size();
+    input.files.resize(n);
+    input.gray.resize(n);
+    input.widths.resize(n);
+    input.heights.resize(n);
+    input.bit_depths.resize(n);
+    for (size_t i = 0; i < n; ++i)
+        input.bit_depths[i] = options.bit_depths[i % options.bit_depths.size()];
+
+    addResult(results, "scan", n, 0, secondsOf(boost::bind(scanCorpus, corpus), FLAGS_repeat));
+    addResult(results, "read", n, corpus_bytes, secondsOf(boost::bind(readCorpus, &input), FLAGS_repeat));
+
+    for (size_t d = 0; d < options.bit_depths.size() && d < n; ++d)
+    {
+        int bpp = options.bit_depths[d];
+        uint64_t files = 0, bytes = 0;
+        for (size_t i = 0; i < n; ++i)
+            if (input.bit_depths[i] == bpp)
+            {
+                files++;
+                bytes += input.files[i].size();
+            }
+        addResult(results, "decode_bmp_" + boost::lexical_cast<string>(bpp), files, bytes,
+                  secondsOf(boost::bind(decodeNative, &input, bpp), FLAGS_repeat));
+    }
+    addResult(results, "decode_opencv", n, corpus_bytes, secondsOf(boost::bind(decodeOpenCV, &input), FLAGS_repeat));
+
+    uint64_t pixels = 0;
+    input.inverted.resize(n);
+    for (size_t i = 0; i < n; ++i) // gray holds every image now, their sides are taken from the headers again
+    {
+        CHECK(decodeBmpGray(&input.files[i][0], input.files[i].size(), input.gray[i], input.widths[i],
+                            input.heights[i]));
+        pixels += input.gray[i].size();
+        input.inverted[i].resize(input.gray[i].size());
+        for (size_t k = 0; k < input.gray[i].size(); ++k)
+            input.inverted[i][k] = static_cast<uchar>(~input.gray[i][k]);
+    }
+    addResult(results, "find_blob_params", n, pixels, secondsOf(boost::bind(findBlobs, &input), FLAGS_repeat));
+    convertToLeNet(&input, true);
+    addResult(results, "lenet_convert", n, pixels,
+              secondsOf(boost::bind(convertToLeNet, &input, false), FLAGS_repeat));
+
+    const int label_rounds = 100; // a single pass is too short to time
+    addResult(results, "get_label", n*label_rounds, 0,
+              secondsOf(boost::bind(getLabels, &input, label_rounds), FLAGS_repeat));
+
+    uint64_t bytes = 0;
+    double seconds = secondsOf(boost::bind(serializeProtobuf, &input, &bytes), FLAGS_repeat);
+    addResult(results, "datum_protobuf", input.lenet.size(), bytes, seconds);
+    seconds = secondsOf(boost::bind(serializeEncoder, &input, &bytes), FLAGS_repeat);
+    addResult(results, "datum_encoder", input.lenet.size(), bytes, seconds);
+
+    uint64_t records = 0;
+    start = monotonicNanoseconds();
+    writeLmdb(&input, FLAGS_work_dir + "/lmdb_write", &records);
+    addResult(results, "lmdb_write", records, records*bytes/std::max<size_t>(input.lenet.size(), 1),
+              (monotonicNanoseconds() - start)*1e-9);
+
+    start = monotonicNanoseconds();
+    convertEndToEnd(&input, FLAGS_work_dir + "/end_to_end", &records, &bytes);
+    addResult(results, "end_to_end", records, bytes, (monotonicNanoseconds() - start)*1e-9);
+
+    if (FLAGS_json.empty())
+        writeJson(std::cout, results);
+    else
+    {
+        std::ofstream out(FLAGS_json.c_str(), std::ios::trunc);
+        writeJson(out, results);
+        CHECK(out.good()) << "Cannot write " << FLAGS_json;
+    }
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include "synthetic_corpus.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+#include <glog/logging.h>
+
+static const char LABELS[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+uint64_t CORPUS_RNG::next()
+{
+    uint64_t z = (state_ += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+int CORPUS_RNG::uniform(int low, int high)
+{
+    return low + static_cast<int>(next() % static_cast<uint64_t>(high - low + 1));
+}
+
+double CORPUS_RNG::real()
+{
+    return (next() >> 11)*(1.0/9007199254740992.0);
+}
+
+bool layoutFromName(const std::string& name, CORPUS_LAYOUT& layout)
+{
+    if (name == "flat")
+        layout = LAYOUT_FLAT;
+    else if (name == "balanced")
+        layout = LAYOUT_BALANCED;
+    else if (name == "skewed")
+        layout = LAYOUT_SKEWED;
+    else
+        return false;
+    return true;
+}
+
+static void fillRect(SYNTHETIC_IMAGE& image, int x0, int y0, int x1, int y1, uchar value) // inclusive, clipped
+{
+    for (int y = std::max(y0, 0); y <= std::min(y1, image.height - 1); ++y)
+        for (int x = std::max(x0, 0); x <= std::min(x1, image.width - 1); ++x)
+            image.gray[y*image.width + x] = value;
+}
+
+void drawImage(CORPUS_RNG& rng, const CORPUS_OPTIONS& options, SYNTHETIC_IMAGE& image)
+{
+    image.width = rng.uniform(options.min_side, options.max_side);
+    image.height = rng.uniform(options.min_side, options.max_side);
+    image.label = LABELS[rng.uniform(0, sizeof(LABELS) - 2)];
+    image.gray.assign(static_cast<size_t>(image.width)*image.height, static_cast<uchar>(rng.uniform(225, 255)));
+    if (rng.real() < options.blank_fraction)
+        return;
+
+    // glyph box inside a margin, strokes a few pixels wide
+    int box_w = std::max(3, image.width*rng.uniform(30, 80)/100);
+    int box_h = std::max(3, image.height*rng.uniform(30, 80)/100);
+    int x0 = rng.uniform(0, image.width - box_w), y0 = rng.uniform(0, image.height - box_h);
+    int x1 = x0 + box_w - 1, y1 = y0 + box_h - 1;
+    int stroke = std::max(1, std::min(box_w, box_h)/rng.uniform(4, 8));
+    uchar ink = static_cast<uchar>(rng.uniform(0, 40));
+    switch (rng.uniform(0, 3))
+    {
+        case 0: // ring
+        {
+            double cx = 0.5*(x0 + x1), cy = 0.5*(y0 + y1), rx = 0.5*box_w, ry = 0.5*box_h;
+            for (int y = y0; y <= y1; ++y)
+                for (int x = x0; x <= x1; ++x)
+                {
+                    double dx = (x - cx)/rx, dy = (y - cy)/ry, r = dx*dx + dy*dy;
+                    double inner = 1 - 2.0*stroke/std::min(box_w, box_h);
+                    if (r <= 1 && r >= inner*inner)
+                        image.gray[y*image.width + x] = ink;
+                }
+            break;
+        }
+        case 1: // L
+            fillRect(image, x0, y0, x0 + stroke - 1, y1, ink);
+            fillRect(image, x0, y1 - stroke + 1, x1, y1, ink);
+            break;
+        case 2: // T
+            fillRect(image, x0, y0, x1, y0 + stroke - 1, ink);
+            fillRect(image, (x0 + x1 - stroke)/2, y0, (x0 + x1 + stroke)/2, y1, ink);
+            break;
+        default: // diagonal
+            for (int y = y0; y <= y1; ++y)
+            {
+                int x = x0 + (y - y0)*(box_w - stroke)/std::max(1, box_h - 1);
+                fillRect(image, x, y, x + stroke - 1, y, ink);
+            }
+    }
+
+    if (rng.real() < options.noise_fraction) // scanner dust, widens the blob bounds
+    {
+        size_t specks = image.gray.size()*rng.uniform(5, 30)/1000;
+        for (size_t i = 0; i < specks; ++i)
+            image.gray[rng.next() % image.gray.size()] = static_cast<uchar>(rng.uniform(0, 90));
+    }
+}
+
+static void put16(std::vector<uchar>& out, size_t at, unsigned value)
+{
+    out[at] = static_cast<uchar>(value);
+    out[at + 1] = static_cast<uchar>(value >> 8);
+}
+
+static void put32(std::vector<uchar>& out, size_t at, uint32_t value)
+{
+    put16(out, at, value & 0xFFFF);
+    put16(out, at + 2, value >> 16);
+}
+
+void encodeBmp(const SYNTHETIC_IMAGE& image, int bpp, std::vector<uchar>& file)
+{
+    CHECK(bpp == 1 || bpp == 4 || bpp == 8 || bpp == 24 || bpp == 32) << "Unsupported bit depth " << bpp;
+    unsigned colors = bpp <= 8 ? 1u << bpp : 0;
+    size_t row_size = ((static_cast<size_t>(image.width)*bpp + 31)/32)*4;
+    size_t data_offset = 14 + 40 + 4*colors;
+    file.assign(data_offset + row_size*image.height, 0);
+
+    file[0] = 'B';
+    file[1] = 'M';
+    put32(file, 2, static_cast<uint32_t>(file.size()));
+    put32(file, 10, static_cast<uint32_t>(data_offset));
+    put32(file, 14, 40); // BITMAPINFOHEADER
+    put32(file, 18, image.width);
+    put32(file, 22, image.height); // positive - bottom-up
+    put16(file, 26, 1);
+    put16(file, 28, bpp);
+    put32(file, 30, 0); // BI_RGB
+    put32(file, 34, static_cast<uint32_t>(row_size*image.height));
+    put32(file, 46, colors);
+    for (unsigned c = 0; c < colors; ++c) // gray ramp
+    {
+        uchar level = static_cast<uchar>(c*255/(colors - 1));
+        file[54 + 4*c] = file[55 + 4*c] = file[56 + 4*c] = level;
+    }
+
+    for (int y = 0; y < image.height; ++y)
+    {
+        const uchar* src = &image.gray[static_cast<size_t>(y)*image.width];
+        uchar* row = &file[data_offset + (image.height - 1 - y)*row_size];
+        for (int x = 0; x < image.width; ++x)
+        {
+            unsigned p = src[x];
+            switch (bpp)
+            {
+                case 1:
+                    row[x >> 3] |= static_cast<uchar>((p >= 128) << (7 - (x & 7)));
+                    break;
+                case 4:
+                    row[x >> 1] |= static_cast<uchar>(((p + 8)/17) << ((x & 1) ? 0 : 4));
+                    break;
+                case 8:
+                    row[x] = static_cast<uchar>(p);
+                    break;
+                default: // 24 or 32: B, G, R(, A)
+                {
+                    uchar* pixel = row + x*(bpp/8);
+                    pixel[0] = pixel[1] = pixel[2] = static_cast<uchar>(p);
+                    if (bpp == 32)
+                        pixel[3] = 255;
+                }
+            }
+        }
+    }
+}
+
+static std::string directoryOf(const CORPUS_OPTIONS& options, CORPUS_RNG& rng, const std::vector<double>& zipf,
+                               size_t image)
+{
+    char name[32];
+    if (options.layout == LAYOUT_FLAT || options.directories == 0)
+        return std::string();
+    if (options.layout == LAYOUT_BALANCED)
+    {
+        snprintf(name, sizeof(name), "d%03u", static_cast<unsigned>(image % options.directories));
+        return name;
+    }
+    double u = rng.real(); // skewed: directory k gets a share proportional to 1/(k+1)
+    size_t k = std::lower_bound(zipf.begin(), zipf.end(), u) - zipf.begin();
+    if (k >= options.directories)
+        k = options.directories - 1;
+    snprintf(name, sizeof(name), "z%03u", static_cast<unsigned>(k));
+    std::string dir(name);
+    for (size_t level = 0; level < k % 4; ++level) // 1 to 4 levels deep
+        dir += "/deeper";
+    return dir;
+}
+
+std::vector<std::string> generateCorpus(const std::string& root, const CORPUS_OPTIONS& options,
+                                        uint64_t* bytes_written)
+{
+    CHECK(!options.bit_depths.empty()) << "No bit depths for the corpus";
+    CHECK(options.min_side >= 3 && options.min_side <= options.max_side) << "Bad image sides";
+
+    std::vector<double> zipf(options.directories); // cumulative, normalised
+    double total = 0;
+    for (size_t k = 0; k < zipf.size(); ++k)
+        zipf[k] = (total += 1.0/(k + 1));
+    for (size_t k = 0; k < zipf.size(); ++k)
+        zipf[k] /= total;
+
+    CORPUS_RNG rng(options.seed);
+    SYNTHETIC_IMAGE image;
+    std::vector<uchar> file;
+    std::vector<std::string> paths;
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < options.images; ++i)
+    {
+        drawImage(rng, options, image);
+        encodeBmp(image, options.bit_depths[i % options.bit_depths.size()], file);
+
+        std::string sub = directoryOf(options, rng, zipf, i);
+        std::string dir = sub.empty() ? root : root + "/" + sub;
+        boost::filesystem::create_directories(dir);
+        char name[48];
+        snprintf(name, sizeof(name), "/img_%c_%06u.bmp", image.label, static_cast<unsigned>(i));
+        std::string path = dir + name;
+        std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&file[0]), file.size());
+        CHECK(out.good()) << "Cannot write " << path;
+        paths.push_back(path);
+        bytes += file.size();
+    }
+    if (bytes_written)
+        *bytes_written = bytes;
+    return paths;
+}
@@ -0,0 +1,71 @@
+#ifndef SYNTHETIC_CORPUS_H
+#define SYNTHETIC_CORPUS_H
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+typedef unsigned char uchar;
+
+enum CORPUS_LAYOUT
+{
+    LAYOUT_FLAT,     // every file in the root directory
+    LAYOUT_BALANCED, // the same number of files in each directory
+    LAYOUT_SKEWED    // Zipf-distributed files over directories 1 to 4 levels deep
+};
+
+struct CORPUS_OPTIONS
+{
+    uint64_t seed;
+    size_t images;
+    std::vector<int> bit_depths; // bmp bits per pixel, dealt to the images in turn: 1, 4, 8, 24, 32
+    int min_side, max_side;      // image sides, in pixels
+    double blank_fraction;       // images with no character, dropped by the converter
+    double noise_fraction;       // images with dark specks around the character
+    CORPUS_LAYOUT layout;
+    size_t directories;          // for the balanced and skewed layouts
+
+    CORPUS_OPTIONS() : seed(1), images(1000), min_side(24), max_side(128), blank_fraction(0.02),
+                       noise_fraction(0.2), layout(LAYOUT_SKEWED), directories(64)
+    {
+        static const int depths[] = {1, 4, 8, 24, 32};
+        bit_depths.assign(depths, depths + sizeof(depths)/sizeof(depths[0]));
+    }
+};
+
+struct SYNTHETIC_IMAGE // dark character on a light background, as the scanned sets are
+{
+    std::vector<uchar> gray; // dense rows
+    int width, height;
+    char label;              // one of 0-9, A-Z, a-z
+};
+
+class CORPUS_RNG // splitmix64, the same sequence on every platform
+{
+public:
+    explicit CORPUS_RNG(uint64_t seed) : state_(seed) {}
+    uint64_t next();
+    int uniform(int low, int high); // [low, high]
+    double real();                  // [0, 1)
+
+private:
+    uint64_t state_;
+};
+
+bool layoutFromName(const std::string& name, CORPUS_LAYOUT& layout); // flat, balanced or skewed
+
+void drawImage(CORPUS_RNG& rng, const CORPUS_OPTIONS& options, SYNTHETIC_IMAGE& image);
+
+// Whole bmp file of `image`, BITMAPINFOHEADER, bottom-up rows; 1, 4 and 8
+// bpp use a gray palette (so 1 and 4 bpp are quantised), 24 and 32 bpp
+// store gray BGR(A) pixels.
+void encodeBmp(const SYNTHETIC_IMAGE& image, int bpp, std::vector<uchar>& file);
+
+// Writes options.images bmp files under root, named .../img_<label>_<n>.bmp
+// so the converter finds their labels, and returns their paths. The same
+// options give the same files, byte for byte.
+std::vector<std::string> generateCorpus(const std::string& root, const CORPUS_OPTIONS& options,
+                                        uint64_t* bytes_written = NULL);
+
+#endif // SYNTHETIC_CORPUS_H
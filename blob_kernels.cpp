@@ -0,0 +1,195 @@
+#include "blob_kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLOB_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+static inline void resetMoments(BLOB_MOMENTS& m, int width, int height)
+{
+    m.min_x = width;
+    m.min_y = height;
+    m.max_x = -1;
+    m.max_y = -1;
+    m.count = m.sum_x = m.sum_y = 0;
+}
+
+// folds the statistics of one row into the image moments
+static inline void addRow(BLOB_MOMENTS& m, int y, uint64_t row_count, uint64_t row_sum_x, int row_min_x, int row_max_x)
+{
+    if (row_count == 0)
+        return;
+    if (m.min_y > y)
+        m.min_y = y;
+    m.max_y = y;
+    if (m.min_x > row_min_x)
+        m.min_x = row_min_x;
+    if (m.max_x < row_max_x)
+        m.max_x = row_max_x;
+    m.count += row_count;
+    m.sum_x += row_sum_x;
+    m.sum_y += row_count * y;
+}
+
+// handles the row tail the vector loops leave behind
+static inline void scalarSpan(uchar* row, int from, int to, bool invert,
+                              uint64_t& count, uint64_t& sum_x, int& min_x, int& max_x)
+{
+    for (int x = from; x < to; ++x)
+    {
+        uchar p = row[x];
+        if (invert)
+            row[x] = p = 255 - p;
+        if (p > 0)
+        {
+            count++;
+            sum_x += x;
+            if (min_x > x)
+                min_x = x;
+            max_x = x;
+        }
+    }
+}
+
+static void measureBlobScalar(uchar* data, int width, int height, size_t step, bool invert, BLOB_MOMENTS& m)
+{
+    resetMoments(m, width, height);
+    for (int y = 0; y < height; ++y)
+    {
+        uint64_t count = 0, sum_x = 0;
+        int min_x = width, max_x = -1;
+        scalarSpan(data + y*step, 0, width, invert, count, sum_x, min_x, max_x);
+        addRow(m, y, count, sum_x, min_x, max_x);
+    }
+}
+
+#ifdef BLOB_KERNELS_X86
+
+// 16 pixels at a time. Foreground lanes come from a compare with zero; their
+// x offsets are summed with psadbw against a 0..15 index vector, so the
+// moments need no per-pixel branches at all.
+__attribute__((target("sse2")))
+static void measureBlobSse2(uchar* data, int width, int height, size_t step, bool invert, BLOB_MOMENTS& m)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i flip = invert ? _mm_set1_epi8(-1) : zero;
+    const __m128i index = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    resetMoments(m, width, height);
+    for (int y = 0; y < height; ++y)
+    {
+        uchar* row = data + y*step;
+        uint64_t count = 0, sum_x = 0;
+        int min_x = width, max_x = -1;
+        __m128i sums = zero;
+
+        int x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x)), flip);
+            if (invert)
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(row + x), v);
+            __m128i background = _mm_cmpeq_epi8(v, zero);
+            unsigned int mask = ~_mm_movemask_epi8(background) & 0xFFFF;
+            if (!mask)
+                continue;
+            unsigned int n = __builtin_popcount(mask);
+            count += n;
+            sum_x += static_cast<uint64_t>(n) * x;
+            sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_andnot_si128(background, index), zero));
+            if (min_x > x + __builtin_ctz(mask))
+                min_x = x + __builtin_ctz(mask);
+            max_x = x + 31 - __builtin_clz(mask);
+        }
+        sum_x += static_cast<uint64_t>(_mm_cvtsi128_si32(sums)) +
+                 static_cast<uint64_t>(_mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums)));
+        scalarSpan(row, x, width, invert, count, sum_x, min_x, max_x);
+        addRow(m, y, count, sum_x, min_x, max_x);
+    }
+}
+
+// same as the SSE2 kernel with 32 pixels per step
+__attribute__((target("avx2,popcnt")))
+static void measureBlobAvx2(uchar* data, int width, int height, size_t step, bool invert, BLOB_MOMENTS& m)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i flip = invert ? _mm256_set1_epi8(-1) : zero;
+    const __m256i index = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                           16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+
+    resetMoments(m, width, height);
+    for (int y = 0; y < height; ++y)
+    {
+        uchar* row = data + y*step;
+        uint64_t count = 0, sum_x = 0;
+        int min_x = width, max_x = -1;
+        __m256i sums = zero;
+
+        int x = 0;
+        for (; x + 32 <= width; x += 32)
+        {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x)), flip);
+            if (invert)
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(row + x), v);
+            __m256i background = _mm256_cmpeq_epi8(v, zero);
+            unsigned int mask = ~static_cast<unsigned int>(_mm256_movemask_epi8(background));
+            if (!mask)
+                continue;
+            unsigned int n = __builtin_popcount(mask);
+            count += n;
+            sum_x += static_cast<uint64_t>(n) * x;
+            sums = _mm256_add_epi64(sums, _mm256_sad_epu8(_mm256_andnot_si256(background, index), zero));
+            if (min_x > x + __builtin_ctz(mask))
+                min_x = x + __builtin_ctz(mask);
+            max_x = x + 31 - __builtin_clz(mask);
+        }
+        __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        sum_x += static_cast<uint64_t>(_mm_cvtsi128_si32(half)) +
+                 static_cast<uint64_t>(_mm_cvtsi128_si32(_mm_unpackhi_epi64(half, half)));
+        scalarSpan(row, x, width, invert, count, sum_x, min_x, max_x);
+        addRow(m, y, count, sum_x, min_x, max_x);
+    }
+}
+
+#endif // BLOB_KERNELS_X86
+
+typedef void (*MEASURE_KERNEL)(uchar*, int, int, size_t, bool, BLOB_MOMENTS&);
+
+struct KERNEL_CHOICE
+{
+    MEASURE_KERNEL kernel;
+    const char* name;
+
+    KERNEL_CHOICE() : kernel(measureBlobScalar), name("scalar")
+    {
+#ifdef BLOB_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            kernel = measureBlobAvx2;
+            name = "avx2";
+        }
+        else if (__builtin_cpu_supports("sse2"))
+        {
+            kernel = measureBlobSse2;
+            name = "sse2";
+        }
+#endif
+    }
+};
+
+static const KERNEL_CHOICE& kernelChoice() // resolved once, on first use
+{
+    static const KERNEL_CHOICE choice;
+    return choice;
+}
+
+void measureBlob(uchar* data, int width, int height, size_t step, bool invert, BLOB_MOMENTS& moments)
+{
+    kernelChoice().kernel(data, width, height, step, invert, moments);
+}
+
+const char* blobKernelName()
+{
+    return kernelChoice().name;
+}
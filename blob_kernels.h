@@ -0,0 +1,24 @@
+#ifndef BLOB_KERNELS_H
+#define BLOB_KERNELS_H
+
+#include <cstddef>
+#include <stdint.h>
+
+typedef unsigned char uchar;
+
+struct BLOB_MOMENTS // foreground (non-zero) pixels of an image
+{
+    int min_x, min_y, max_x, max_y; // inclusive bounds, meaningless when count == 0
+    uint64_t count;                 // number of foreground pixels
+    uint64_t sum_x, sum_y;          // first order moments, centroid = sum / count
+};
+
+// Single pass over a 8-bit image: optionally inverts it in place
+// (p = 255 - p) and measures the foreground of the resulting image.
+// Implemented with SSE2 and AVX2, picked at runtime for the running CPU,
+// with a scalar fallback for other architectures.
+void measureBlob(uchar* data, int width, int height, size_t step, bool invert, BLOB_MOMENTS& moments);
+
+const char* blobKernelName(); // "avx2", "sse2" or "scalar"
+
+#endif // BLOB_KERNELS_H
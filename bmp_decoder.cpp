@@ -0,0 +1,141 @@
+#include "bmp_decoder.h"
+
+#include <stdint.h>
+
+#define BMP_FILE_HEADER_SIZE 14
+#define BMP_CORE_HEADER_SIZE 12   // OS/2 BITMAPCOREHEADER
+#define BMP_INFO_HEADER_SIZE 40   // BITMAPINFOHEADER, V2-V5 headers extend it
+#define BMP_MAX_SIDE 65536        // refuse absurd sizes from corrupted headers
+
+#define BI_RGB 0
+#define BI_BITFIELDS 3
+
+// same fixed-point weights as OpenCV uses for BGR2GRAY
+#define GRAY_SHIFT 14
+#define GRAY_R 4899
+#define GRAY_G 9617
+#define GRAY_B 1868
+
+static inline uint16_t readU16(const uchar* p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t readU32(const uchar* p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static inline uchar bgrToGray(uchar b, uchar g, uchar r)
+{
+    return static_cast<uchar>((b*GRAY_B + g*GRAY_G + r*GRAY_R + (1 << (GRAY_SHIFT-1))) >> GRAY_SHIFT);
+}
+
+bool decodeBmpGray(const uchar* data, size_t size, std::vector<uchar>& gray, int& width, int& height)
+{
+    if (size < BMP_FILE_HEADER_SIZE + BMP_CORE_HEADER_SIZE || data[0] != 'B' || data[1] != 'M')
+        return false;
+
+    uint32_t pixels_offset = readU32(data + 10);
+    uint32_t header_size = readU32(data + BMP_FILE_HEADER_SIZE);
+    const uchar* header = data + BMP_FILE_HEADER_SIZE;
+    if (BMP_FILE_HEADER_SIZE + static_cast<size_t>(header_size) > size)
+        return false;
+
+    int64_t w, h;
+    int bpp;
+    uint32_t compression = BI_RGB, colors_used = 0;
+    size_t palette_entry_size;
+    if (header_size == BMP_CORE_HEADER_SIZE)
+    {
+        w = readU16(header + 4);
+        h = readU16(header + 6);
+        bpp = readU16(header + 10);
+        palette_entry_size = 3;
+    }
+    else if (header_size >= BMP_INFO_HEADER_SIZE)
+    {
+        w = static_cast<int32_t>(readU32(header + 4));
+        h = static_cast<int32_t>(readU32(header + 8));
+        bpp = readU16(header + 14);
+        compression = readU32(header + 16);
+        colors_used = readU32(header + 32);
+        palette_entry_size = 4;
+    }
+    else
+        return false;
+
+    bool top_down = h < 0;
+    if (top_down)
+        h = -h;
+    if (w <= 0 || h <= 0 || w > BMP_MAX_SIDE || h > BMP_MAX_SIDE)
+        return false;
+
+    if (compression == BI_BITFIELDS) // accept only the masks that mean plain BGR(A)
+    {
+        if (bpp != 32)
+            return false;
+        const uchar* masks = header + BMP_INFO_HEADER_SIZE; // inside v2+ headers, right after v1 one
+        if (BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE + 12 > size ||
+                readU32(masks) != 0x00FF0000 || readU32(masks + 4) != 0x0000FF00 || readU32(masks + 8) != 0x000000FF)
+            return false;
+    }
+    else if (compression != BI_RGB)
+        return false;
+
+    uchar palette[256]; // gray level of every palette entry
+    if (bpp == 1 || bpp == 4 || bpp == 8)
+    {
+        size_t max_colors = static_cast<size_t>(1) << bpp;
+        size_t colors = (colors_used == 0 || colors_used > max_colors) ? max_colors : colors_used;
+        const uchar* entry = header + header_size;
+        if (BMP_FILE_HEADER_SIZE + header_size + colors*palette_entry_size > size)
+            return false;
+        for (size_t i = 0; i < colors; ++i, entry += palette_entry_size)
+            palette[i] = bgrToGray(entry[0], entry[1], entry[2]);
+        for (size_t i = colors; i < 256; ++i) // out of range indices read as black
+            palette[i] = 0;
+    }
+    else if (bpp != 24 && bpp != 32)
+        return false;
+
+    size_t stride = ((static_cast<size_t>(w)*bpp + 31) / 32) * 4; // rows are padded to 4 bytes
+    if (pixels_offset > size || stride*static_cast<size_t>(h) > size - pixels_offset)
+        return false;
+
+    width = static_cast<int>(w);
+    height = static_cast<int>(h);
+    if (gray.size() < static_cast<size_t>(width)*height)
+        gray.resize(static_cast<size_t>(width)*height);
+
+    for (int y = 0; y < height; ++y)
+    {
+        const uchar* src = data + pixels_offset + stride*(top_down ? y : height - 1 - y);
+        uchar* dst = &gray[static_cast<size_t>(y)*width];
+        switch (bpp)
+        {
+            case 1:
+                for (int x = 0; x < width; ++x)
+                    dst[x] = palette[(src[x >> 3] >> (7 - (x & 7))) & 1];
+                break;
+            case 4:
+                for (int x = 0; x < width; ++x)
+                    dst[x] = palette[(x & 1) ? (src[x >> 1] & 0x0F) : (src[x >> 1] >> 4)];
+                break;
+            case 8:
+                for (int x = 0; x < width; ++x)
+                    dst[x] = palette[src[x]];
+                break;
+            case 24:
+                for (int x = 0; x < width; ++x, src += 3)
+                    dst[x] = bgrToGray(src[0], src[1], src[2]);
+                break;
+            case 32:
+                for (int x = 0; x < width; ++x, src += 4)
+                    dst[x] = bgrToGray(src[0], src[1], src[2]);
+                break;
+        }
+    }
+    return true;
+}
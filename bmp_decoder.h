@@ -0,0 +1,21 @@
+#ifndef BMP_DECODER_H
+#define BMP_DECODER_H
+
+#include <cstddef>
+#include <vector>
+
+typedef unsigned char uchar;
+
+// Decodes an in-memory bmp file straight to 8-bit grayscale.
+// Handles uncompressed 1/4/8 bpp palette images and 24/32 bpp BGR(A)
+// images (including BI_BITFIELDS with the standard masks), stored either
+// bottom-up or top-down. Gray levels match OpenCV's BGR2GRAY conversion,
+// so results are the same as cv::imread(..., CV_LOAD_IMAGE_GRAYSCALE).
+// `gray` is only grown, never shrunk, so a buffer reused across files stops
+// allocating once it has seen the largest image. Rows are stored densely
+// (step == width).
+// Returns false for anything else (RLE, 16 bpp, odd masks, truncated
+// files); the caller is expected to fall back to a generic decoder.
+bool decodeBmpGray(const uchar* data, size_t size, std::vector<uchar>& gray, int& width, int& height);
+
+#endif // BMP_DECODER_H
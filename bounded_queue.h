@@ -0,0 +1,70 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <deque>
+
+#include <boost/thread.hpp>
+
+// Blocking FIFO with fixed capacity used between pipeline stages.
+// push() waits while the queue is full (backpressure on the producer),
+// pop() waits while it is empty. After close() producers are rejected and
+// consumers drain the remaining items and then get false.
+template <class T>
+class BOUNDED_QUEUE
+{
+public:
+    explicit BOUNDED_QUEUE(size_t capacity) : capacity_(capacity ? capacity : 1), closed_(false) {}
+
+    bool push(const T& item)
+    {
+        boost::unique_lock<boost::mutex> lock(mtx_);
+        while (items_.size() >= capacity_ && !closed_)
+            not_full_.wait(lock);
+        if (closed_)
+            return false;
+        items_.push_back(item);
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        boost::unique_lock<boost::mutex> lock(mtx_);
+        while (items_.empty() && !closed_)
+            not_empty_.wait(lock);
+        if (items_.empty())
+            return false; // closed and drained
+        item = items_.front();
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        boost::lock_guard<boost::mutex> lock(mtx_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    size_t size() const
+    {
+        boost::lock_guard<boost::mutex> lock(mtx_);
+        return items_.size();
+    }
+
+    size_t capacity() const { return capacity_; }
+
+private:
+    std::deque<T> items_;
+    size_t capacity_;
+    bool closed_;
+    mutable boost::mutex mtx_;
+    boost::condition_variable not_empty_, not_full_;
+
+    BOUNDED_QUEUE(const BOUNDED_QUEUE&);
+    BOUNDED_QUEUE& operator=(const BOUNDED_QUEUE&);
+};
+
+#endif // BOUNDED_QUEUE_H
@@ -0,0 +1,103 @@
+#include "dataset_split.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <stdint.h>
+
+#include "manifest.h"
+
+static const char* const DEFAULT_NAMES[] = {"train", "val", "test"};
+
+static uint64_t pathHash(const std::string& source) // hash of the path, mixed, so it does not follow shard placement
+{
+    uint64_t h = hashFileContents(source.data(), source.size());
+    h ^= h >> 33; // murmur3 finalizer
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    return h ^ (h >> 33);
+}
+
+bool DATASET_SPLIT::parse(const std::string& spec)
+{
+    names.clear();
+    weights.clear();
+    double total = 0;
+    size_t from = 0;
+    while (from <= spec.size())
+    {
+        size_t to = spec.find(',', from);
+        if (to == std::string::npos)
+            to = spec.size();
+        std::string item = spec.substr(from, to - from);
+        from = to + 1;
+
+        std::string name, weight = item;
+        size_t colon = item.find(':');
+        if (colon != std::string::npos)
+        {
+            name = item.substr(0, colon);
+            weight = item.substr(colon + 1);
+        }
+        else if (names.size() < sizeof(DEFAULT_NAMES)/sizeof(DEFAULT_NAMES[0]))
+            name = DEFAULT_NAMES[names.size()];
+        if (name.empty() || std::find(names.begin(), names.end(), name) != names.end())
+            return false;
+
+        char* end = NULL;
+        double w = strtod(weight.c_str(), &end);
+        if (weight.empty() || *end != '\0' || !(w > 0))
+            return false;
+        names.push_back(name);
+        weights.push_back(w);
+        total += w;
+    }
+    if (names.size() < 2 || names.size() > MAX_SPLITS)
+        return false;
+    for (size_t s = 0; s < weights.size(); ++s)
+        weights[s] /= total;
+    return true;
+}
+
+int DATASET_SPLIT::byPath(const std::string& source) const
+{
+    double u = (pathHash(source) >> 11)*(1.0/9007199254740992.0); // 53 bits -> [0, 1)
+    double bound = 0;
+    for (size_t s = 0; s + 1 < weights.size(); ++s)
+    {
+        bound += weights[s];
+        if (u < bound)
+            return static_cast<int>(s);
+    }
+    return static_cast<int>(weights.size()) - 1;
+}
+
+void DATASET_SPLIT::stratify(const std::vector<std::string>& sources, const std::vector<char>& strata,
+                             std::vector<int>& splits) const
+{
+    typedef std::vector< std::pair<uint64_t, size_t> > STRATUM; // (path hash, file)
+    std::map<char, STRATUM> by_label;
+    for (size_t i = 0; i < sources.size(); ++i)
+        by_label[strata[i]].push_back(std::make_pair(pathHash(sources[i]), i));
+
+    splits.assign(sources.size(), 0);
+    for (std::map<char, STRATUM>::iterator it = by_label.begin(); it != by_label.end(); ++it)
+    {
+        STRATUM& files = it->second;
+        std::sort(files.begin(), files.end()); // independent of the scan order
+        std::vector<double> current(weights.size(), 0);
+        for (size_t f = 0; f < files.size(); ++f)
+        {
+            size_t best = 0;
+            for (size_t s = 0; s < weights.size(); ++s)
+            {
+                current[s] += weights[s];
+                if (current[s] > current[best])
+                    best = s;
+            }
+            current[best] -= 1; // weights sum to 1
+            splits[files[f].second] = static_cast<int>(best);
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef DATASET_SPLIT_H
+#define DATASET_SPLIT_H
+
+#include <string>
+#include <vector>
+
+#define MAX_SPLITS 8
+
+// Train/val/test split of the converted images, decided while converting,
+// so every split is written to its own database in the same pass.
+// A split is "name:weight"; a bare weight is named train, val, test in
+// turn, so "0.8,0.1,0.1" and "train:8,val:1,test:1" are the same split.
+struct DATASET_SPLIT
+{
+    std::vector<std::string> names;
+    std::vector<double> weights;   // normalised, sum to 1
+
+    bool parse(const std::string& spec); // false - malformed
+    size_t size() const { return names.size(); }
+
+    // Split of a file from its path relative to the converted directory.
+    // A hash of the path only, so a file keeps its split in every run,
+    // whatever else is added or removed.
+    int byPath(const std::string& source) const;
+
+    // Splits of a whole file list that meet the weights within every
+    // label (stratum) up to one file: files of a label are ordered by the
+    // hash of their path and dealt to the splits by smooth weighted
+    // round-robin. Adding files shifts that order, so unlike byPath() a
+    // file may change its split between runs.
+    void stratify(const std::vector<std::string>& sources, const std::vector<char>& strata,
+                  std::vector<int>& splits) const;
+};
+
+#endif // DATASET_SPLIT_H
@@ -0,0 +1,111 @@
+#include "datum_encoder.h"
+
+#include <cstring>
+#include <string>
+#include <stdint.h>
+
+#include <glog/logging.h>
+
+#include "caffe/proto/caffe.pb.h"
+
+// field numbers of caffe.proto's Datum
+#define DATUM_CHANNELS 1
+#define DATUM_HEIGHT 2
+#define DATUM_WIDTH 3
+#define DATUM_DATA 4
+#define DATUM_LABEL 5
+
+#define WIRE_VARINT 0
+#define WIRE_LENGTH_DELIMITED 2
+
+static size_t varintSize(uint64_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static size_t int32Size(int value) // negative int32 is sign-extended to 10 bytes, as protobuf does
+{
+    return varintSize(static_cast<uint64_t>(static_cast<int64_t>(value)));
+}
+
+static uchar* writeVarint(uint64_t value, uchar* out)
+{
+    while (value >= 0x80)
+    {
+        *out++ = static_cast<uchar>(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<uchar>(value);
+    return out;
+}
+
+static uchar* writeInt32Field(int field, int value, uchar* out)
+{
+    *out++ = static_cast<uchar>((field << 3) | WIRE_VARINT); // every tag here fits one byte
+    return writeVarint(static_cast<uint64_t>(static_cast<int64_t>(value)), out);
+}
+
+size_t datumWireSize(const DATUM_SHAPE& shape, size_t data_size)
+{
+    return 1 + int32Size(shape.channels) +
+           1 + int32Size(shape.height) +
+           1 + int32Size(shape.width) +
+           1 + varintSize(data_size) + data_size +
+           1 + int32Size(shape.label);
+}
+
+uchar* encodeDatum(const DATUM_SHAPE& shape, const void* data, size_t data_size, uchar* out)
+{
+    out = writeInt32Field(DATUM_CHANNELS, shape.channels, out);
+    out = writeInt32Field(DATUM_HEIGHT, shape.height, out);
+    out = writeInt32Field(DATUM_WIDTH, shape.width, out);
+    *out++ = static_cast<uchar>((DATUM_DATA << 3) | WIRE_LENGTH_DELIMITED);
+    out = writeVarint(data_size, out);
+    if (data_size)
+        memcpy(out, data, data_size);
+    out += data_size;
+    return writeInt32Field(DATUM_LABEL, shape.label, out);
+}
+
+bool datumMatches(const void* encoded, size_t size, const DATUM_SHAPE& shape, const void* data, size_t data_size)
+{
+    caffe::Datum datum;
+    return datum.ParseFromArray(encoded, static_cast<int>(size)) &&
+           datum.channels() == shape.channels && datum.height() == shape.height && datum.width() == shape.width &&
+           datum.label() == shape.label && datum.data().size() == data_size &&
+           (data_size == 0 || memcmp(datum.data().data(), data, data_size) == 0);
+}
+
+size_t checkStoredDatums(MDB_env* env, MDB_dbi dbi, int channels, int side)
+{
+    MDB_txn* txn;
+    MDB_cursor* cursor;
+    CHECK_EQ(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn), MDB_SUCCESS) << "mdb_txn_begin failed";
+    CHECK_EQ(mdb_cursor_open(txn, dbi, &cursor), MDB_SUCCESS) << "mdb_cursor_open failed";
+    static const MDB_cursor_op ends[] = {MDB_FIRST, MDB_LAST};
+    size_t checked = 0;
+    for (size_t i = 0; i < sizeof(ends)/sizeof(ends[0]); ++i)
+    {
+        MDB_val mdb_key, mdb_data;
+        if (mdb_cursor_get(cursor, &mdb_key, &mdb_data, ends[i]) != MDB_SUCCESS)
+            break; // empty database
+        std::string key(static_cast<const char*>(mdb_key.mv_data), mdb_key.mv_size);
+        caffe::Datum datum;
+        CHECK(datum.ParseFromArray(mdb_data.mv_data, static_cast<int>(mdb_data.mv_size)))
+            << "Record " << key << " is not a caffe::Datum";
+        CHECK(datum.channels() == channels && datum.height() == side && datum.width() == side &&
+              datum.data().size() == static_cast<size_t>(channels)*side*side)
+            << "Record " << key << " is " << datum.channels() << "x" << datum.height() << "x" << datum.width()
+            << " with " << datum.data().size() << " bytes of data, expected " << channels << "x" << side << "x" << side;
+        ++checked;
+    }
+    mdb_cursor_close(cursor);
+    mdb_txn_abort(txn);
+    return checked;
+}
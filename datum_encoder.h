@@ -0,0 +1,39 @@
+#ifndef DATUM_ENCODER_H
+#define DATUM_ENCODER_H
+
+#include <cstddef>
+
+#include <lmdb.h>
+
+typedef unsigned char uchar;
+
+struct DATUM_SHAPE // fixed fields of caffe::Datum
+{
+    int channels, height, width;
+    int label;
+
+    DATUM_SHAPE() : channels(0), height(0), width(0), label(0) {}
+};
+
+// Protobuf wire encoding of a caffe::Datum with channels, height, width,
+// data and label set, byte-for-byte what Datum::SerializeToString produces
+// for it (fields in number order, int32 as varints, data length-delimited).
+// The size is known up front, so the bytes can be written straight into a
+// buffer reserved in the database (mdb_put with MDB_RESERVE) instead of
+// going through a Datum and a std::string.
+size_t datumWireSize(const DATUM_SHAPE& shape, size_t data_size);
+uchar* encodeDatum(const DATUM_SHAPE& shape, const void* data, size_t data_size, uchar* out); // returns the end of the encoding
+
+// Parses `size` encoded bytes with caffe::Datum and compares the result
+// with the shape and data they were made from. The writer runs it on a
+// sample of its records before they are committed.
+bool datumMatches(const void* encoded, size_t size, const DATUM_SHAPE& shape, const void* data, size_t data_size);
+
+// Reads the first and the last record of the database back and parses them
+// with caffe::Datum, CHECK-fails unless both are channels x side x side
+// images. Catches what comparing the encoder with protobuf cannot: a writer
+// storing something other than the encoding. Returns the records checked,
+// 0 for an empty database.
+size_t checkStoredDatums(MDB_env* env, MDB_dbi dbi, int channels, int side);
+
+#endif // DATUM_ENCODER_H
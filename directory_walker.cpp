@@ -0,0 +1,168 @@
+#include "directory_walker.h"
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <stdint.h>
+
+#include <boost/bind.hpp>
+#include <glog/logging.h>
+#include <sys/stat.h>
+
+#include "stage_timer.h"
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <boost/filesystem.hpp>
+#endif
+
+enum ENTRY_TYPE {ENTRY_UNKNOWN, ENTRY_FILE, ENTRY_DIRECTORY, ENTRY_SYMLINK, ENTRY_OTHER};
+
+DIRECTORY_WALKER::DIRECTORY_WALKER(WORK_STEALING_POOL& pool, const FileHandler& on_file, size_t buffer_size) :
+    pool_(pool), on_file_(on_file), buffer_size_(buffer_size), directories_(0), files_(0)
+{
+}
+
+void DIRECTORY_WALKER::walk(const std::string& root)
+{
+    pool_.submit(boost::bind(&DIRECTORY_WALKER::walkDirectory, this, root));
+}
+
+bool DIRECTORY_WALKER::firstVisit(unsigned long long dev, unsigned long long ino)
+{
+    boost::lock_guard<boost::mutex> lock(visited_mtx_);
+    return visited_.insert(std::make_pair(dev, ino)).second;
+}
+
+void DIRECTORY_WALKER::visit(const std::string& dir, const char* name, int type)
+{
+    if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) // "." and ".."
+        return;
+
+    std::string entry(dir);
+    if (entry.empty() || entry[entry.size()-1] != '/')
+        entry += '/';
+    entry += name;
+
+    if (type == ENTRY_SYMLINK || type == ENTRY_UNKNOWN) // d_type does not tell, ask the file system
+    {
+        struct stat st;
+        if (stat(entry.c_str(), &st) != 0)
+            return; // dangling symlink
+        type = S_ISDIR(st.st_mode) ? ENTRY_DIRECTORY : (S_ISREG(st.st_mode) ? ENTRY_FILE : ENTRY_OTHER);
+    }
+
+    if (type == ENTRY_DIRECTORY)
+        pool_.submit(boost::bind(&DIRECTORY_WALKER::walkDirectory, this, entry));
+    else if (type == ENTRY_FILE)
+    {
+        files_.fetch_add(1, boost::memory_order_relaxed);
+        on_file_(entry);
+    }
+}
+
+#ifdef __linux__
+
+struct LINUX_DIRENT64 // record layout returned by getdents64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+static int entryType(unsigned char d_type)
+{
+    switch (d_type)
+    {
+        case DT_REG:
+            return ENTRY_FILE;
+        case DT_DIR:
+            return ENTRY_DIRECTORY;
+        case DT_LNK:
+            return ENTRY_SYMLINK;
+        case DT_UNKNOWN:
+            return ENTRY_UNKNOWN;
+    }
+    return ENTRY_OTHER;
+}
+
+static boost::thread_specific_ptr<std::vector<char> > dirent_buffer; // one per pool thread
+
+void DIRECTORY_WALKER::walkDirectory(const std::string& dir)
+{
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        LOG(WARNING) << "Cannot open directory " << dir << ": " << strerror(errno);
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && !firstVisit(st.st_dev, st.st_ino)) // reached again through a symlink
+    {
+        close(fd);
+        return;
+    }
+    directories_.fetch_add(1, boost::memory_order_relaxed);
+
+    if (!dirent_buffer.get())
+        dirent_buffer.reset(new std::vector<char>(buffer_size_));
+    std::vector<char>& buffer = *dirent_buffer;
+
+    for (;;)
+    {
+        long n;
+        {
+            SCOPED_TIMER timer(TIMER_SCAN);
+            n = syscall(SYS_getdents64, fd, &buffer[0], buffer.size());
+        }
+        if (n == 0)
+            break;
+        if (n < 0)
+        {
+            LOG(WARNING) << "Cannot read directory " << dir << ": " << strerror(errno);
+            break;
+        }
+        for (long offset = 0; offset < n; )
+        {
+            const LINUX_DIRENT64* entry = reinterpret_cast<const LINUX_DIRENT64*>(&buffer[offset]);
+            offset += entry->d_reclen;
+            visit(dir, entry->d_name, entryType(entry->d_type));
+        }
+    }
+    close(fd);
+}
+
+#else // portable fallback
+
+void DIRECTORY_WALKER::walkDirectory(const std::string& dir)
+{
+    namespace fs = boost::filesystem;
+    boost::system::error_code ec;
+    fs::directory_iterator it(dir, ec), end;
+    if (ec)
+    {
+        LOG(WARNING) << "Cannot open directory " << dir << ": " << ec.message();
+        return;
+    }
+    directories_.fetch_add(1, boost::memory_order_relaxed);
+
+    for (; it != end; it.increment(ec))
+    {
+        if (ec)
+            break;
+        fs::file_status status = it->symlink_status();
+        int type = fs::is_symlink(status) ? ENTRY_SYMLINK :
+                   (fs::is_directory(status) ? ENTRY_DIRECTORY : (fs::is_regular_file(status) ? ENTRY_FILE : ENTRY_OTHER));
+        visit(dir, it->path().filename().string().c_str(), type);
+    }
+}
+
+#endif
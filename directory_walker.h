@@ -0,0 +1,52 @@
+#ifndef DIRECTORY_WALKER_H
+#define DIRECTORY_WALKER_H
+
+#include <set>
+#include <string>
+#include <utility>
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include "thread_pool.h"
+
+// Recursive directory walk spread over a WORK_STEALING_POOL: every
+// directory is a pool task and its subdirectories become new tasks, so
+// wide and deep trees are listed by all workers at once.
+// On Linux directories are read with getdents64 into a large per-thread
+// buffer and entries are classified by d_type, so regular files and
+// directories cost no stat call; only symlinks and file systems that
+// report DT_UNKNOWN are stat'ed. Symlinks are followed like
+// boost::filesystem does, with a guard against directory loops.
+// Elsewhere boost::filesystem::directory_iterator is used.
+class DIRECTORY_WALKER
+{
+public:
+    typedef boost::function<void(const std::string&)> FileHandler; // called from pool threads
+
+    DIRECTORY_WALKER(WORK_STEALING_POOL& pool, const FileHandler& on_file, size_t buffer_size = 1 << 20);
+
+    void walk(const std::string& root); // returns at once, pool.wait() waits for the walk
+
+    size_t directories() const { return directories_.load(); }
+    size_t files() const { return files_.load(); }
+
+private:
+    void walkDirectory(const std::string& dir);
+    void visit(const std::string& dir, const char* name, int type);
+    bool firstVisit(unsigned long long dev, unsigned long long ino); // loop guard for followed symlinks
+
+    WORK_STEALING_POOL& pool_;
+    FileHandler on_file_;
+    size_t buffer_size_;
+    boost::atomic<size_t> directories_, files_;
+
+    boost::mutex visited_mtx_;
+    std::set<std::pair<unsigned long long, unsigned long long> > visited_;
+
+    DIRECTORY_WALKER(const DIRECTORY_WALKER&);
+    DIRECTORY_WALKER& operator=(const DIRECTORY_WALKER&);
+};
+
+#endif // DIRECTORY_WALKER_H
@@ -0,0 +1,141 @@
+#include "image_stats.h"
+
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+
+#include <glog/logging.h>
+
+#include "caffe/proto/caffe.pb.h"
+
+IMAGE_STATS::IMAGE_STATS(int size, int classes) : size_(size), classes_(classes), local_(&IMAGE_STATS::keep)
+{
+}
+
+IMAGE_STATS::ACCUMULATOR* IMAGE_STATS::local()
+{
+    ACCUMULATOR* accumulator = local_.get();
+    if (!accumulator) // first image of this thread
+    {
+        boost::shared_ptr<ACCUMULATOR> created(new ACCUMULATOR());
+        created->sum.assign(static_cast<size_t>(size_)*size_, 0);
+        created->sum_sq.assign(static_cast<size_t>(size_)*size_, 0);
+        created->classes.assign(classes_, 0);
+        created->count = 0;
+        {
+            boost::lock_guard<boost::mutex> lock(mtx_);
+            accumulators_.push_back(created);
+        }
+        accumulator = created.get();
+        local_.reset(accumulator);
+    }
+    return accumulator;
+}
+
+void IMAGE_STATS::add(const uchar* pixels, int label)
+{
+    ACCUMULATOR* accumulator = local();
+    uint64_t* sum = &accumulator->sum[0];
+    uint64_t* sum_sq = &accumulator->sum_sq[0];
+    size_t n = accumulator->sum.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        unsigned p = pixels[i];
+        sum[i] += p;
+        sum_sq[i] += p*p;
+    }
+    if (label >= 0 && label < classes_)
+        accumulator->classes[label]++;
+    accumulator->count++;
+}
+
+void IMAGE_STATS::merge(ACCUMULATOR& total) const
+{
+    total.sum.assign(static_cast<size_t>(size_)*size_, 0);
+    total.sum_sq.assign(total.sum.size(), 0);
+    total.classes.assign(classes_, 0);
+    total.count = 0;
+
+    boost::lock_guard<boost::mutex> lock(mtx_);
+    for (size_t a = 0; a < accumulators_.size(); ++a)
+    {
+        const ACCUMULATOR& part = *accumulators_[a];
+        for (size_t i = 0; i < total.sum.size(); ++i)
+        {
+            total.sum[i] += part.sum[i];
+            total.sum_sq[i] += part.sum_sq[i];
+        }
+        for (int c = 0; c < classes_; ++c)
+            total.classes[c] += part.classes[c];
+        total.count += part.count;
+    }
+}
+
+size_t IMAGE_STATS::images() const
+{
+    boost::lock_guard<boost::mutex> lock(mtx_);
+    uint64_t count = 0;
+    for (size_t a = 0; a < accumulators_.size(); ++a)
+        count += accumulators_[a]->count;
+    return count;
+}
+
+void IMAGE_STATS::writeMean(const std::string& file_name) const
+{
+    ACCUMULATOR total;
+    merge(total);
+
+    caffe::BlobProto blob; // the layout compute_image_mean writes
+    blob.set_num(1);
+    blob.set_channels(1);
+    blob.set_height(size_);
+    blob.set_width(size_);
+    for (size_t i = 0; i < total.sum.size(); ++i)
+        blob.add_data(total.count ? static_cast<float>(static_cast<double>(total.sum[i])/total.count) : 0.f);
+
+    std::ofstream out(file_name.c_str(), std::ios::binary | std::ios::trunc);
+    CHECK(out.good() && blob.SerializeToOstream(&out)) << "Cannot write " << file_name;
+}
+
+void IMAGE_STATS::writeJson(const std::string& file_name) const
+{
+    ACCUMULATOR total;
+    merge(total);
+
+    double n = total.count ? static_cast<double>(total.count) : 1.;
+    uint64_t all_sum = 0, all_sum_sq = 0;
+    for (size_t i = 0; i < total.sum.size(); ++i)
+    {
+        all_sum += total.sum[i];
+        all_sum_sq += total.sum_sq[i];
+    }
+    double pixels = n*total.sum.size();
+    double all_mean = all_sum/pixels;
+    double all_var = all_sum_sq/pixels - all_mean*all_mean;
+
+    std::ofstream out(file_name.c_str(), std::ios::trunc);
+    CHECK(out.good()) << "Cannot write " << file_name;
+    out << std::fixed << std::setprecision(4)
+        << "{\n"
+        << "  \"images\": " << total.count << ",\n"
+        << "  \"channels\": 1,\n"
+        << "  \"height\": " << size_ << ",\n"
+        << "  \"width\": " << size_ << ",\n"
+        << "  \"mean_value\": " << all_mean << ",\n"
+        << "  \"std_value\": " << std::sqrt(all_var > 0 ? all_var : 0) << ",\n"
+        << "  \"class_counts\": [";
+    for (int c = 0; c < classes_; ++c)
+        out << (c ? ", " : "") << total.classes[c];
+    out << "],\n  \"mean\": [";
+    for (size_t i = 0; i < total.sum.size(); ++i)
+        out << (i ? ", " : "") << total.sum[i]/n;
+    out << "],\n  \"std\": [";
+    for (size_t i = 0; i < total.sum.size(); ++i)
+    {
+        double mean = total.sum[i]/n;
+        double var = total.sum_sq[i]/n - mean*mean; // population variance, as over the whole database
+        out << (i ? ", " : "") << std::sqrt(var > 0 ? var : 0);
+    }
+    out << "]\n}\n";
+    CHECK(out.good()) << "Cannot write " << file_name;
+}
@@ -0,0 +1,55 @@
+#ifndef IMAGE_STATS_H
+#define IMAGE_STATS_H
+
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <stdint.h>
+
+typedef unsigned char uchar;
+
+#define MEAN_FILE_NAME "mean.binaryproto"
+#define STATS_FILE_NAME "stats.json"
+
+// Mean image and per-pixel standard deviation of the images stored in one
+// database, gathered while they are converted, so training prep does not
+// need another pass over the database (caffe's compute_image_mean).
+// Every thread calling add() gets its own accumulator of integer sums, so
+// the hot path takes no lock and shares no cache lines; the sums are exact,
+// so merging them gives the same result in any order.
+class IMAGE_STATS
+{
+public:
+    IMAGE_STATS(int size, int classes);
+
+    void add(const uchar* pixels, int label); // any thread
+
+    // after the last add()
+    size_t images() const;
+    void writeMean(const std::string& file_name) const; // caffe BlobProto, 1 x 1 x size x size
+    void writeJson(const std::string& file_name) const;
+
+private:
+    struct ACCUMULATOR
+    {
+        std::vector<uint64_t> sum, sum_sq; // per pixel
+        std::vector<uint64_t> classes;     // images per label
+        uint64_t count;
+    };
+
+    ACCUMULATOR* local();
+    void merge(ACCUMULATOR& total) const;
+    static void keep(ACCUMULATOR*) {} // accumulators outlive their threads
+
+    int size_, classes_;
+    boost::thread_specific_ptr<ACCUMULATOR> local_;
+    mutable boost::mutex mtx_;
+    std::vector< boost::shared_ptr<ACCUMULATOR> > accumulators_; // every thread's, guarded by mtx_
+
+    IMAGE_STATS(const IMAGE_STATS&);
+    IMAGE_STATS& operator=(const IMAGE_STATS&);
+};
+
+#endif // IMAGE_STATS_H
@@ -0,0 +1,68 @@
+#include "key_permutation.h"
+
+#include <glog/logging.h>
+
+#define HALF_MASK ((1u << HALF_BITS) - 1)
+
+static uint64_t splitMix64(uint64_t& state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+KEY_PERMUTATION::KEY_PERMUTATION(uint64_t seed, uint32_t domain) : domain_(domain)
+{
+    CHECK(domain > 0 && domain <= (1u << (2*HALF_BITS))) << "Key domain does not fit the permutation";
+    uint64_t state = seed;
+    for (int r = 0; r < ROUNDS; ++r)
+        keys_[r] = splitMix64(state);
+}
+
+uint32_t KEY_PERMUTATION::round(uint32_t half, int r) const
+{
+    uint64_t state = keys_[r] ^ half;
+    return static_cast<uint32_t>(splitMix64(state)) & HALF_MASK;
+}
+
+uint32_t KEY_PERMUTATION::encrypt(uint32_t value) const
+{
+    uint32_t left = value >> HALF_BITS, right = value & HALF_MASK;
+    for (int r = 0; r < ROUNDS; ++r)
+    {
+        uint32_t next = left ^ round(right, r);
+        left = right;
+        right = next;
+    }
+    return (left << HALF_BITS) | right;
+}
+
+uint32_t KEY_PERMUTATION::decrypt(uint32_t value) const
+{
+    uint32_t left = value >> HALF_BITS, right = value & HALF_MASK;
+    for (int r = ROUNDS - 1; r >= 0; --r)
+    {
+        uint32_t prev = right ^ round(left, r);
+        right = left;
+        left = prev;
+    }
+    return (left << HALF_BITS) | right;
+}
+
+uint32_t KEY_PERMUTATION::forward(uint32_t index) const
+{
+    CHECK_LT(index, domain_) << "Too many records for the shuffled key space";
+    uint32_t value = encrypt(index);
+    while (value >= domain_) // cycle walking
+        value = encrypt(value);
+    return value;
+}
+
+uint32_t KEY_PERMUTATION::inverse(uint32_t key) const
+{
+    uint32_t value = decrypt(key);
+    while (value >= domain_)
+        value = decrypt(value);
+    return value;
+}
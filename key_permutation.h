@@ -0,0 +1,34 @@
+#ifndef KEY_PERMUTATION_H
+#define KEY_PERMUTATION_H
+
+#include <stdint.h>
+
+#define KEY_DOMAIN 100000000 // "%08d" keys
+
+// Seeded pseudo-random bijection of [0, domain): item i of a database is
+// stored under key forward(i), so a database read in key order, as caffe
+// does, comes out shuffled without a second pass and without keeping any
+// table. A balanced Feistel network over 28 bits is a permutation of
+// [0, 2^28); values past the domain are walked through it again until
+// they fall inside (cycle walking), which keeps it a permutation of the
+// domain itself. Fewer than 3 rounds of walking are needed on average.
+class KEY_PERMUTATION
+{
+public:
+    explicit KEY_PERMUTATION(uint64_t seed, uint32_t domain = KEY_DOMAIN);
+
+    uint32_t forward(uint32_t index) const;
+    uint32_t inverse(uint32_t key) const;
+    uint32_t domain() const { return domain_; }
+
+private:
+    uint32_t encrypt(uint32_t value) const;
+    uint32_t decrypt(uint32_t value) const;
+    uint32_t round(uint32_t half, int r) const;
+
+    enum { HALF_BITS = 14, ROUNDS = 6 };
+    uint32_t domain_;
+    uint64_t keys_[ROUNDS];
+};
+
+#endif // KEY_PERMUTATION_H
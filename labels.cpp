@@ -0,0 +1,165 @@
+#include "labels.h"
+
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+
+using std::string;
+using namespace boost::algorithm;
+
+typedef std::vector< string > split_vector_type;
+
+char getClassNumbers(char label) // returns the class of the given character with respect to digits set
+                                // based on ASCII characters
+                                // 11 - unknown class
+{
+    char res = static_cast<int>(label)-48;
+    if ((res > 10) || (res < 0))
+            res = -1;
+    return res;
+}
+
+char getClassCapLetters(char label) // returns the class of the given character with respect to capital letters set
+                                   // based on ASCII characters
+                                   // 26 - unknown class
+{
+    char res = static_cast<int>(label)-65;
+    if ((res > 25) || (res < 0))
+            res = -1;
+    return res;
+}
+
+char getClassSmallLetters(char label) // returns the class of the given character with respect to small letters set
+                                   // based on ASCII characters
+                                   // 26 - uknkown class
+{
+    char res = static_cast<int>(label)-97;
+    if ((res > 25) || (res < 0))
+            res = -1;
+    return res;
+}
+
+int argToClass(char c)
+{
+
+    switch(c)
+    {
+        case 'd':  // digits
+        case 'D':
+            return DIGITS;
+
+        case 's':  // small letters
+        case 'S':
+            return SMALL_LETTERS;
+
+        case 'c':
+        case 'C':
+            return CAP_LETTERS;
+
+        case 'a':  // all 62 classes together
+        case 'A':
+            return ALL_CLASSES;
+
+    }
+
+    return -1;
+}
+
+string classToString(int c)
+{
+
+    switch(c)
+    {
+        case DIGITS:
+            return "DIGITS";
+
+        case SMALL_LETTERS:
+            return "SMALL_LETTERS";
+
+        case CAP_LETTERS:
+            return "CAP_LETTERS";
+
+        case ALL_CLASSES:
+            return "ALL_CLASSES";
+    }
+
+    return "INCORRECT";
+}
+
+int classCount(int c) // labels of the set are 0 .. classCount - 1
+{
+    switch(c)
+    {
+        case DIGITS:
+            return 10;
+
+        case SMALL_LETTERS:
+        case CAP_LETTERS:
+            return 26;
+
+        case ALL_CLASSES:
+            return 62;
+    }
+
+    return 0;
+}
+
+string classToSuffix(int c) // database name suffix when several sets are converted at once
+{
+    switch(c)
+    {
+        case DIGITS:
+            return "digits";
+
+        case SMALL_LETTERS:
+            return "small";
+
+        case CAP_LETTERS:
+            return "capitals";
+
+        case ALL_CLASSES:
+            return "all";
+    }
+
+    return "";
+}
+
+char getLabelChar(const string& path) // character the image shows, 0 - file name has no label
+{
+    split_vector_type SplitVec;
+    split( SplitVec, path, is_any_of("_"), token_compress_on );
+    if (SplitVec.size() < 2)
+        return 0;
+    return SplitVec[SplitVec.size()-2].c_str()[0]; // get a label of image
+}
+
+char labelToClass(char clabel, LABEL_SET type) // class of the character within the set, -1 - not in the set
+{
+    char res;
+    switch (type)
+    {
+        case DIGITS:
+            return getClassNumbers(clabel);
+        case CAP_LETTERS:
+            return getClassCapLetters(clabel);
+        case SMALL_LETTERS:
+            return getClassSmallLetters(clabel);
+        case ALL_CLASSES: // digits 0-9, capital letters 10-35, small letters 36-61
+            res = getClassNumbers(clabel);
+            if (res != -1 && res < 10)
+                return res;
+            res = getClassCapLetters(clabel);
+            if (res != -1)
+                return res + 10;
+            res = getClassSmallLetters(clabel);
+            if (res != -1)
+                return res + 36;
+            return -1;
+    }
+    return -1;
+}
+
+char getLabel(string path, LABEL_SET type) // returns class of the label
+{
+    return labelToClass(getLabelChar(path), type);
+}
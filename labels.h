@@ -0,0 +1,27 @@
+#ifndef LABELS_H
+#define LABELS_H
+
+#include <string>
+
+enum LABEL_SET {DIGITS, CAP_LETTERS, SMALL_LETTERS, ALL_CLASSES};
+
+// Labels come from file names: the character the image shows is the first
+// character of the last but one "_"-separated part of the path, e.g.
+// .../img_a_0042.bmp shows 'a'. Within a set the character maps to a class
+// number, digits 0-9, capital letters 10-35 and small letters 36-61 in
+// ALL_CLASSES.
+
+char getClassNumbers(char label);
+char getClassCapLetters(char label);
+char getClassSmallLetters(char label);
+
+int argToClass(char c); // command line letter to LABEL_SET, -1 - none
+std::string classToString(int c);
+int classCount(int c); // labels of the set are 0 .. classCount - 1
+std::string classToSuffix(int c); // database name suffix when several sets are converted at once
+
+char getLabelChar(const std::string& path); // character the image shows, 0 - file name has no label
+char labelToClass(char clabel, LABEL_SET type); // class of the character within the set, -1 - not in the set
+char getLabel(std::string path, LABEL_SET type); // returns class of the label
+
+#endif // LABELS_H
@@ -0,0 +1,78 @@
+#include "lenet_image.h"
+
+#include <algorithm>
+
+#include "blob_kernels.h"
+
+using namespace cv;
+using std::max;
+
+int findBlobParams(Mat& img, Rect& bounds, Point2f& centroid, bool invert) //finds blob's bounds and centroid
+                                                                      //returns number of blobs points
+                                                                      //invert - color inversion in the same pass
+{
+    BLOB_MOMENTS moments;
+    measureBlob(img.ptr(), img.size().width, img.size().height, img.step, invert, moments); // vectorized single pass
+
+    if (moments.count == 0) // blank image, there is no character
+    {
+        bounds = Rect(0, 0, 0, 0);
+        centroid = Point2f(0, 0);
+        return 0;
+    }
+
+    bounds = Rect(moments.min_x, moments.min_y,
+                  moments.max_x - moments.min_x + 1, moments.max_y - moments.min_y + 1);
+    centroid = Point2f(static_cast<float>(static_cast<double>(moments.sum_x)/moments.count - bounds.x),
+                       static_cast<float>(static_cast<double>(moments.sum_y)/moments.count - bounds.y));
+
+    //    cout << "bounds.x = " << bounds.x << endl
+    //         << "bounds.y = " << bounds.y << endl
+    //         << "bounds.height = " << bounds.height << endl
+    //         << "bounds.width = " << bounds.width << endl
+    //         << "Found " << moments.count << " points" << endl
+    //         << "Center of masses " << centroid;
+    return static_cast<int>(moments.count);
+}
+
+int placeCharacter(Mat& img, double pad, CANVAS_PLACEMENT& placement) // finds where the character goes on the canvas,
+                                                                     // the same for every output size
+                                                                     // img is inverted in place
+{
+    Rect bounds;
+    Point2f cm;
+
+    if (findBlobParams(img, bounds, cm, true) == 0)  //color inversion for LeNet and certain character position
+        return -1;
+
+    int max_side = static_cast<int>((max(bounds.width, bounds.height))*pad); // image should have sides equal to maximum side of character's frame
+
+    // the character is placed on a black max_side x max_side canvas with its centroid in the middle
+    Point2i disp(cvRound(0.5*max_side - cm.x), cvRound(0.5*max_side - cm.y)); // displacement of centroid
+
+    int yieldX = max_side - (disp.x + bounds.width); // cut the boundaries,
+    int yieldY = max_side - (disp.y + bounds.height); // if cut image does not fit destination image
+    if (yieldX < 0)
+        bounds.width += yieldX;
+    if (yieldY < 0)
+        bounds.height += yieldY;
+
+    if (disp.x < 0)
+        disp.x = 0;
+    if (disp.y < 0)
+        disp.y = 0;
+
+    if (bounds.width <= 0 || bounds.height <= 0 ||
+            disp.x + bounds.width > max_side || disp.y + bounds.height > max_side) // character does not fit the canvas
+        return -1;
+
+    placement.side = max_side;
+    placement.x = disp.x;
+    placement.y = disp.y;
+    placement.width = bounds.width;
+    placement.height = bounds.height;
+    placement.src_x = bounds.x;
+    placement.src_y = bounds.y;
+
+    return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef LENET_IMAGE_H
+#define LENET_IMAGE_H
+
+#include <opencv2/opencv.hpp>
+
+#include "resample.h"
+
+// Geometry of the character in a decoded grayscale image: the character is
+// dark on a light background, it is inverted to light on black for LeNet
+// and centred by its centroid on a square canvas `pad` times its larger
+// side, which cropPadResize() then scales to the network input size.
+
+int findBlobParams(cv::Mat& img, cv::Rect& bounds, cv::Point2f& centroid, bool invert = false); //finds blob's bounds and centroid
+                                                                                              //returns number of blobs points
+                                                                                              //invert - color inversion in the same pass
+int placeCharacter(cv::Mat& img, double pad, CANVAS_PLACEMENT& placement); // finds where the character goes on the canvas,
+                                                                          // the same for every output size
+                                                                          // img is inverted in place, -1 - no character
+
+#endif // LENET_IMAGE_H
@@ -0,0 +1,241 @@
+#include "lmdb_writer.h"
+
+#include <boost/bind.hpp>
+#include <glog/logging.h>
+
+#include "stage_timer.h"
+
+#define WRITER_IDLE_WAIT_MS 100 // longest sleep of an idle writer, stale transactions are committed in between
+
+LMDB_WRITER::LMDB_WRITER(MDB_env* env, MDB_dbi dbi, const WRITER_OPTIONS& options) :
+    env_(env), dbi_(dbi), txn_(NULL), options_(options), txn_records_(0), txn_bytes_(0), txn_checked_(false),
+    next_item_(options.first_item), last_key_(options.last_key), depth_(0), written_(0), commits_(0),
+    appended_(0), removed_(0), done_(false), sleeping_(false), blocked_(0)
+{
+    if (options_.queue_capacity == 0)
+        options_.queue_capacity = 1;
+    thread_ = boost::thread(boost::bind(&LMDB_WRITER::writerLoop, this));
+}
+
+LMDB_WRITER::~LMDB_WRITER()
+{
+    finish();
+}
+
+void LMDB_WRITER::push(DB_RECORD* record)
+{
+    if (depth_.load(boost::memory_order_relaxed) >= options_.queue_capacity) // writer is far behind
+    {
+        SCOPED_TIMER timer(TIMER_WRITER_WAIT);
+        boost::unique_lock<boost::mutex> lock(room_mtx_);
+        blocked_.fetch_add(1); // seq_cst pairs with the load in writerLoop()
+        while (depth_.load() >= options_.queue_capacity)
+            room_cv_.wait(lock);
+        blocked_.fetch_sub(1);
+    }
+
+    depth_.fetch_add(1, boost::memory_order_relaxed);
+    queue_.push(record);
+
+    if (sleeping_.load()) // seq_cst pairs with the store in sleep()
+    {
+        boost::lock_guard<boost::mutex> lock(wake_mtx_);
+        wake_cv_.notify_one();
+    }
+}
+
+void LMDB_WRITER::finish()
+{
+    if (!thread_.joinable())
+        return;
+    done_.store(true);
+    {
+        boost::lock_guard<boost::mutex> lock(wake_mtx_);
+        wake_cv_.notify_one();
+    }
+    thread_.join();
+}
+
+void LMDB_WRITER::receive(DB_RECORD* record) // puts records back in item_no order
+{
+    if (!options_.append || record->item_no < next_item_) // unordered or too late for the buffer
+    {
+        store(record);
+        return;
+    }
+
+    reorder_[record->item_no] = record;
+    while (!reorder_.empty() &&
+           (reorder_.begin()->first == next_item_ || reorder_.size() > options_.reorder_window))
+    {
+        std::map<long, DB_RECORD*>::iterator first = reorder_.begin();
+        next_item_ = first->first + 1; // a gap left in front of it is given up on
+        store(first->second);
+        reorder_.erase(first);
+    }
+}
+
+void LMDB_WRITER::deleteKey(const std::string& key)
+{
+    MDB_val mdb_key;
+    mdb_key.mv_size = key.size();
+    mdb_key.mv_data = const_cast<char*>(key.data());
+    int rc = mdb_del(txn_, dbi_, &mdb_key, NULL);
+    CHECK(rc == MDB_SUCCESS || rc == MDB_NOTFOUND) << "mdb_del failed";
+    if (rc == MDB_SUCCESS)
+        removed_.fetch_add(1, boost::memory_order_relaxed);
+}
+
+void LMDB_WRITER::store(DB_RECORD* record)
+{
+    if (record->kind == DB_RECORD::SKIP) // its place in the order is all it had
+    {
+        delete record;
+        return;
+    }
+
+    if (record->kind == DB_RECORD::TOUCH)
+    {
+        if (options_.manifest)
+            options_.manifest->touched(record->source, record->origin);
+    }
+    else if (record->kind == DB_RECORD::REMOVE)
+    {
+        deleteKey(record->key);
+        if (options_.manifest)
+            options_.manifest->removed(record->source, record->key);
+    }
+    else
+    {
+        MDB_val mdb_key, mdb_data;
+        mdb_data.mv_size = record->datum ? datumWireSize(record->shape, record->pixels.size()) : record->value.size();
+        mdb_data.mv_data = record->datum ? NULL : reinterpret_cast<void*>(&record->value[0]);
+        mdb_key.mv_size = record->key.size();
+        mdb_key.mv_data = reinterpret_cast<void*>(&record->key[0]);
+
+        // lmdb compares keys bytewise, same as std::string, and MDB_APPEND
+        // needs the key to be past the end of the database
+        unsigned int flags = record->datum ? MDB_RESERVE : 0; // lmdb hands out the space, the Datum is encoded there
+        if (options_.append && (last_key_.empty() || record->key > last_key_))
+        {
+            flags |= MDB_APPEND;
+            last_key_ = record->key;
+            appended_.fetch_add(1, boost::memory_order_relaxed);
+        }
+        {
+            SCOPED_TIMER timer(TIMER_MDB_PUT);
+            CHECK_EQ(mdb_put(txn_, dbi_, &mdb_key, &mdb_data, flags), MDB_SUCCESS)
+                << "mdb_put failed";
+            if (record->datum) // data pointer is valid until the next update of the transaction
+            {
+                const uchar* pixels = record->pixels.empty() ? NULL : &record->pixels[0];
+                uchar* encoded = static_cast<uchar*>(mdb_data.mv_data);
+                uchar* end = encodeDatum(record->shape, pixels, record->pixels.size(), encoded);
+                if (!txn_checked_) // a sample per commit, before the commit
+                {
+                    CHECK(end == encoded + mdb_data.mv_size &&
+                          datumMatches(encoded, mdb_data.mv_size, record->shape, pixels, record->pixels.size()))
+                        << "Record " << record->key << " does not parse back as its Datum, run with --reserve=false";
+                    txn_checked_ = true;
+                }
+            }
+        }
+        txn_bytes_ += mdb_data.mv_size; // encoded size, the key is counted below
+        written_.fetch_add(1, boost::memory_order_relaxed);
+
+        if (!record->replaces.empty()) // source has changed, its old record goes away
+            deleteKey(record->replaces);
+        if (options_.manifest && !record->source.empty())
+        {
+            record->origin.key = record->key;
+            options_.manifest->added(record->source, record->origin);
+        }
+    }
+
+    txn_records_++;
+    txn_bytes_ += record->key.size();
+    delete record;
+    if ((options_.commit_records && txn_records_ >= options_.commit_records) ||
+            (options_.commit_bytes && txn_bytes_ >= options_.commit_bytes))
+    {
+        commitTransaction();
+        beginTransaction();
+    }
+}
+
+void LMDB_WRITER::commitIfStale() // bounds the work a crash can lose when records trickle in
+{
+    if (options_.commit_seconds && txn_records_ &&
+            boost::get_system_time() - txn_started_ >= boost::posix_time::seconds(static_cast<long>(options_.commit_seconds)))
+    {
+        commitTransaction();
+        beginTransaction();
+    }
+}
+
+void LMDB_WRITER::beginTransaction()
+{
+    // write transactions belong to the thread that began them
+    CHECK_EQ(mdb_txn_begin(env_, NULL, 0, &txn_), MDB_SUCCESS)
+        << "mdb_txn_begin failed";
+    txn_records_ = 0;
+    txn_bytes_ = 0;
+    txn_checked_ = false;
+    txn_started_ = boost::get_system_time();
+}
+
+void LMDB_WRITER::commitTransaction()
+{
+    SCOPED_TIMER timer(TIMER_COMMIT);
+    if (options_.manifest) // journal goes first, a checkpoint tells whether the commit made it
+        options_.manifest->flush();
+    CHECK_EQ(mdb_txn_commit(txn_), MDB_SUCCESS)
+        << "mdb_txn_commit failed";
+    txn_ = NULL;
+    commits_.fetch_add(1, boost::memory_order_relaxed);
+    if (options_.manifest)
+        options_.manifest->checkpoint(false);
+}
+
+void LMDB_WRITER::sleep()
+{
+    boost::unique_lock<boost::mutex> lock(wake_mtx_);
+    sleeping_.store(true);
+    if (queue_.empty() && !done_.load()) // re-check after announcing the sleep
+        wake_cv_.timed_wait(lock, boost::posix_time::milliseconds(WRITER_IDLE_WAIT_MS));
+    sleeping_.store(false);
+}
+
+void LMDB_WRITER::writerLoop()
+{
+    beginTransaction();
+
+    unsigned polls = 0;
+    for (;;)
+    {
+        DB_RECORD* record = queue_.pop();
+        if (record)
+        {
+            depth_.fetch_sub(1); // seq_cst pairs with the increment of blocked_ in push()
+            if (blocked_.load())
+            {
+                boost::lock_guard<boost::mutex> lock(room_mtx_);
+                room_cv_.notify_all();
+            }
+            receive(record);
+            if ((++polls & 0xff) == 0)
+                commitIfStale();
+            continue;
+        }
+        commitIfStale();
+
+        if (done_.load() && depth_.load() == 0) // producers are finished and everything is stored
+            break;
+        sleep();
+    }
+
+    for (std::map<long, DB_RECORD*>::iterator it = reorder_.begin(); it != reorder_.end(); ++it)
+        store(it->second); // whatever still waits for a missing predecessor
+    reorder_.clear();
+    commitTransaction();
+}
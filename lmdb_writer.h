@@ -0,0 +1,129 @@
+#ifndef LMDB_WRITER_H
+#define LMDB_WRITER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <lmdb.h>
+
+#include "datum_encoder.h"
+#include "manifest.h"
+#include "mpsc_queue.h"
+
+struct DB_RECORD // serialized key/value pair (or a bookkeeping change) on its way to lmdb
+{
+    enum KIND
+    {
+        PUT,    // store key/value, replacing `replaces` if set
+        TOUCH,  // source is unchanged, only its manifest entry is refreshed
+        REMOVE, // source is gone, delete the record under key
+        SKIP    // item_no will never be stored, the reorder buffer stops waiting for it
+    };
+
+    KIND kind;
+    std::string key, value;         // value - serialized record, unless datum is set
+    bool datum;                     // the writer encodes the Datum itself, straight into the database
+    std::vector<uchar> pixels;      // Datum data if datum is set, handed over by the producer
+    DATUM_SHAPE shape;              // Datum fields besides data
+    long item_no;                   // position in key order, -1 - not ordered
+    std::string source;             // source file relative path, empty - not tracked by the manifest
+    MANIFEST_ENTRY origin;          // source file state, the key is filled in by the writer
+    std::string replaces;           // key of the outdated record made from the same source
+    boost::atomic<DB_RECORD*> next; // MPSC_QUEUE link
+
+    DB_RECORD() : kind(PUT), datum(false), item_no(-1), next(NULL) {}
+};
+
+struct WRITER_OPTIONS
+{
+    size_t queue_capacity;  // records allowed to wait in the queue
+    size_t commit_records;  // commit after that many puts, 0 - no limit
+    size_t commit_bytes;    // commit after that many bytes of keys and values, 0 - no limit
+    size_t commit_seconds;  // commit a transaction open that long, 0 - no limit
+    bool append;            // restore item_no order and insert with MDB_APPEND
+    size_t reorder_window;  // out of order records held back before giving up on a gap
+    long first_item;        // item_no expected first
+    std::string last_key;   // greatest key already in the database, empty - none
+    MANIFEST* manifest;     // journal of record sources, written ahead of every commit
+                            // and checkpointed after it, NULL - none
+
+    WRITER_OPTIONS() : queue_capacity(4096), commit_records(1000), commit_bytes(64 << 20),
+                       commit_seconds(10), append(true), reorder_window(1024), first_item(0), manifest(NULL) {}
+};
+
+// Owns the write transaction of one lmdb environment and is the only thread
+// calling mdb_put on it. Producers hand records over with push(), which
+// never touches the database: it is a lock-free enqueue, and it blocks only
+// when more than queue_capacity records are queued (backpressure on memory),
+// on a condition variable the writer signals as it drains the queue. An
+// idle writer sleeps until a record arrives.
+// The transaction is committed in chunks (commit_records/commit_bytes/
+// commit_seconds), so lmdb's dirty page list and the cost of each commit
+// stay bounded and every commit is a durable point of the conversion: with
+// a manifest, each commit is checkpointed and a crashed run can be resumed
+// from it. The first Datum the writer encodes in every transaction is
+// parsed back before the commit, so a broken encoding stops the run before
+// any of it is durable.
+// Producers number their records (item_no) in key order but finish them out
+// of order. With `append` on, the writer holds early records in a small
+// reorder buffer and stores them in item_no order with MDB_APPEND, which
+// skips the B-tree search and packs pages full. If the buffer outgrows
+// reorder_window the lowest record is written anyway; records arriving
+// behind it fall back to a regular put, so a slow producer costs speed
+// but never correctness or memory.
+class LMDB_WRITER
+{
+public:
+    LMDB_WRITER(MDB_env* env, MDB_dbi dbi, const WRITER_OPTIONS& options);
+    ~LMDB_WRITER();
+
+    void push(DB_RECORD* record); // takes ownership of record
+    void finish(); // writes everything pushed so far, commits and stops the thread
+
+    size_t written() const { return written_.load(); }
+    size_t depth() const { return depth_.load(); }
+    size_t commits() const { return commits_.load(); }
+    size_t appended() const { return appended_.load(); }
+    size_t removed() const { return removed_.load(); }
+
+private:
+    void writerLoop();
+    void receive(DB_RECORD* record);
+    void store(DB_RECORD* record);
+    void deleteKey(const std::string& key);
+    void commitIfStale();
+    void sleep();
+    void beginTransaction();
+    void commitTransaction();
+
+    MDB_env* env_;
+    MDB_dbi dbi_;
+    MDB_txn* txn_;
+    WRITER_OPTIONS options_;
+    size_t txn_records_, txn_bytes_; // size of the open transaction, bytes as stored
+    bool txn_checked_;               // a Datum of the open transaction has been parsed back
+    boost::system_time txn_started_;
+
+    std::map<long, DB_RECORD*> reorder_; // records waiting for their predecessors
+    long next_item_;                     // item_no the writer waits for
+    std::string last_key_;               // greatest key stored so far
+
+    MPSC_QUEUE<DB_RECORD> queue_;
+    boost::atomic<size_t> depth_, written_, commits_, appended_, removed_;
+    boost::atomic<bool> done_, sleeping_;
+
+    boost::mutex wake_mtx_;
+    boost::condition_variable wake_cv_;
+    boost::atomic<size_t> blocked_; // producers waiting for room in the queue
+    boost::mutex room_mtx_;
+    boost::condition_variable room_cv_;
+    boost::thread thread_;
+
+    LMDB_WRITER(const LMDB_WRITER&);
+    LMDB_WRITER& operator=(const LMDB_WRITER&);
+};
+
+#endif // LMDB_WRITER_H
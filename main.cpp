@@ -2,23 +2,84 @@
 #include <iterator>
 #include <algorithm>
 #include <cstdio>
+#include <fstream>
+#include <limits>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/shared_ptr.hpp>
 #include <opencv2/opencv.hpp>
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include <lmdb.h>
 #include <glog/logging.h>
+#include <gflags/gflags.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "caffe/proto/caffe.pb.h"
-
-#define IMAGE_SIZE 28
-#define SCALE_FACTOR 1.5
-#define MAXIMUM_NUMBER_OF_THREADS 10
-#define DISPLAY_PERIOD 3000
-
+#include "thread_pool.h"
+#include "directory_walker.h"
+#include "pipeline.h"
+#include "lmdb_writer.h"
+#include "bmp_decoder.h"
+#include "blob_kernels.h"
+#include "resample.h"
+#include "manifest.h"
+#include "shard_index.h"
+#include "datum_encoder.h"
+#include "image_stats.h"
+#include "key_permutation.h"
+#include "dataset_split.h"
+#include "stage_timer.h"
+#include "progress_reporter.h"
+#include "labels.h"
+#include "lenet_image.h"
+
+// gflags 2.1 moved everything from google:: to gflags::
+#ifndef GFLAGS_GFLAGS_H_
+namespace gflags = google;
+#endif
+
+DEFINE_string(size, "28", "Side of the square network input image, in pixels; several sizes "
+                          "separated by commas go to one database each, e.g. 28,32,64");
+DEFINE_double(pad, 1.5, "Canvas side around the character, relative to the longer side of its bounding box");
+DEFINE_int32(read_threads, 4, "Threads reading bmp files from disk");
+DEFINE_int32(decode_threads, 0, "Threads decoding bmp files, 0 - one per hardware thread");
+DEFINE_int32(preprocess_threads, 0, "Threads transforming images for LeNet, 0 - one per hardware thread");
+DEFINE_int32(serialize_threads, 1, "Threads serializing Datum records, 0 - one per hardware thread");
+DEFINE_int32(dirent_buffer_kb, 1024, "Size of the directory listing buffer of every walker thread");
+DEFINE_bool(native_bmp, true, "Decode common bmp variants natively, falling back to OpenCV for the rest");
+DEFINE_int32(queue_depth, 256, "Capacity of every queue between pipeline stages");
+DEFINE_int32(writer_queue_depth, 4096, "Serialized records allowed to wait for the lmdb writer");
+DEFINE_uint64(commit_records, 1000, "Commit lmdb transaction every N records, 0 - no limit");
+DEFINE_uint64(commit_mb, 64, "Commit lmdb transaction every N megabytes of records, 0 - no limit");
+DEFINE_bool(append, true, "Store records in key order with MDB_APPEND");
+DEFINE_int32(key_block, 1, "Keys a serializer thread takes from a database at a time, 1 - one by one. "
+                           "Blocks touch the shared counter less often, but records of other threads' blocks "
+                           "outrun --reorder_window and are put without MDB_APPEND, and the rest of a thread's "
+                           "last block is a gap in the keys unless it is the last block taken");
+DEFINE_int32(reorder_window, 1024, "Out of order records the writer may hold back for MDB_APPEND");
+DEFINE_bool(manifest, true, "Keep a manifest of converted files, so a rerun on an existing lmdb converts only the changes");
+DEFINE_bool(resume, false, "Continue an interrupted conversion from its last checkpoint");
+DEFINE_uint64(commit_seconds, 10, "Commit lmdb transaction open for N seconds, 0 - no limit");
+DEFINE_int32(shards, 1, "Write every database as N lmdb shards with a writer each, see also --merge");
+DEFINE_string(shard_placement, "round_robin", "Which shard an image goes to: round_robin or hash (of its path)");
+DEFINE_bool(reserve, true, "Encode Datum records straight into lmdb pages (MDB_RESERVE) instead of via caffe::Datum");
+DEFINE_bool(deterministic, false, "Give keys in sorted path order, so the output does not depend on thread timing");
+DEFINE_bool(shuffle, false, "Store records under keys from a seeded permutation, so the database reads shuffled");
+DEFINE_uint64(seed, 1, "Seed of the --shuffle permutation, reruns on a database have to use the same one");
+DEFINE_string(split, "", "Route every image to one of several databases by a hash of its path, "
+              "e.g. 0.8,0.1,0.1 or train:8,val:1,test:1 writes <db>_train, <db>_val and <db>_test");
+DEFINE_bool(stratify, false, "With --split, keep the split ratios within every label; "
+            "then a file may change its split when others are added");
+DEFINE_int32(progress_seconds, 10, "Log the progress, speed and time left this often, 0 - only at the end");
+DEFINE_bool(timing, true, "Time the stages of every image and log their latency histograms");
+DEFINE_int32(timing_seconds, 60, "Log the stage timings this often, 0 - only at the end");
+DEFINE_bool(stats, true, "Write " MEAN_FILE_NAME " and " STATS_FILE_NAME " of every new database");
+DEFINE_bool(merge, false, "Fold a sharded database into a single one: bmp_converter --merge <sharded_db> <db>");
 
 using namespace std;
 using namespace boost::filesystem;
@@ -34,323 +95,927 @@ using boost::shared_ptr;
 typedef vector< string > split_vector_type;
 typedef vector< path > vec;             // store paths
 
-enum LABEL_SET {DIGITS, CAP_LETTERS, SMALL_LETTERS};
+#define MAX_OUTPUTS 32 // databases per run: label sets x output sizes x splits
+#define SHUFFLE_FILE_NAME "shuffle" // seed of a shuffled database
+
+struct KEY_BLOCK // keys taken from a database by one thread
+{
+    int next, end;
+    boost::atomic<int>* counter; // the block came from
+    LMDB_WRITER* writer;         // stores the keys, learns about the unused ones
+
+    KEY_BLOCK(boost::atomic<int>* from, LMDB_WRITER* to) : next(0), end(0), counter(from), writer(to) {}
+};
+
+void releaseKeyBlock(KEY_BLOCK* block) // the serializer thread is finished: the rest of its block goes back
+                                       // to the counter if no block was taken after it, else the writer skips it
+{
+    int end = block->end;
+    if (block->next < end && !block->counter->compare_exchange_strong(end, block->next))
+        for (int item_no = block->next; item_no < block->end; ++item_no)
+        {
+            DB_RECORD* skip = new DB_RECORD();
+            skip->kind = DB_RECORD::SKIP;
+            skip->item_no = item_no;
+            block->writer->push(skip);
+        }
+    delete block;
+}
 
 struct LMDB_DESCRIPTOR //principle variables for lmdb
 {
     // shared variables
     MDB_env *mdb_env;
     MDB_dbi mdb_dbi;
-    MDB_val mdb_key, mdb_data;
-    MDB_txn *mdb_txn;
-    uint files_number;
-    mutex mtx_;
-    int getFileIndex() const {return file_idx;}
-
-    // methods
-    LMDB_DESCRIPTOR() : items_index(0), files_number(0),
-                        file_idx(0) {}
-    void lock() { mtx_.lock(); }
-    void unlock() { mtx_.unlock(); }
-    int increaseItemsCounter()
-    {
-	// lock mutex when we need to increase counter
-        mtx_.lock();
-        int ret = items_index;
-        items_index++;
-        mtx_.unlock();
-        return ret;
+    int getFileIndex() const {return file_idx.load(boost::memory_order_relaxed);} // bmp files found by the scan so far
+
+    // methods, counters are relaxed atomics: nothing else is published through them
+    LMDB_DESCRIPTOR() : items_index(0), first_item(0), file_idx(0), unchanged(0), key_block(releaseKeyBlock) {}
+    void setFirstItem(int item_no) // keys of the existing records are below item_no, before the workers start
+    {
+        first_item = item_no;
+        items_index.store(item_no, boost::memory_order_relaxed);
+    }
+    int getFirstItem() const {return first_item;}
+    int increaseItemsCounter() // next key, keys stay dense
+    {
+        return items_index.fetch_add(1, boost::memory_order_relaxed);
+    }
+    int reserveItem(int block_size, LMDB_WRITER* writer) // next key of the calling thread's block, a new block
+                                                         // every block_size keys, so the counter is touched once
+                                                         // per block; blocks of threads interleave
+    {
+        if (block_size <= 1)
+            return increaseItemsCounter();
+        KEY_BLOCK* block = key_block.get();
+        if (!block)
+        {
+            block = new KEY_BLOCK(&items_index, writer);
+            key_block.reset(block);
+        }
+        if (block->next == block->end)
+        {
+            block->next = items_index.fetch_add(block_size, boost::memory_order_relaxed);
+            block->end = block->next + block_size;
+        }
+        return block->next++;
     }
     void increaseCurrentFileIndex()
     {
-        mtx_.lock();
-        file_idx ++;
-        mtx_.unlock();
+        file_idx.fetch_add(1, boost::memory_order_relaxed);
+    }
+    void increaseUnchanged()
+    {
+        unchanged.fetch_add(1, boost::memory_order_relaxed);
+    }
+    int getUnchanged() const
+    {
+        return unchanged.load(boost::memory_order_relaxed);
     }
 
 private:
-    int items_index, file_idx; //number of items
-
+    boost::atomic<int> items_index;
+    int first_item;
+    boost::atomic<int> file_idx; // bmp files found by the scan
+    boost::atomic<int> unchanged; // files skipped as already converted
+    boost::thread_specific_ptr<KEY_BLOCK> key_block; // of the serializer thread, released when it ends
 };
 
-LABEL_SET TARGET_SET;
+struct SHARD // single lmdb environment with its writer
+{
+    string db_path;
+    LMDB_DESCRIPTOR lmdb; // environment and keys of the shard
+    MANIFEST manifest;
+    shared_ptr<LMDB_WRITER> writer;
+    bool update; // database existed, only the changes are converted
+
+    explicit SHARD(const string& path) : db_path(path), manifest(path), update(false) {}
+};
 
-int findBlobParams(Mat& img, Rect& bounds, Point2f& centroid) //finds blob's bounds and centroid
-                                                                      //returns number of blobs points
+struct OUTPUT_DB // one database of the conversion, images go there by the class of their label
 {
-    uchar* img_ptr;
-    int blob_points = 0;
-    bounds = Rect(img.size().width, img.size().height, 0, 0);
-    centroid = Point2f(0, 0);
+    LABEL_SET label_set;
+    int size;                        // side of the images
+    size_t size_index;               // which of IMAGE_RECORD::lenet they come from
+    int split;                       // images of which split, -1 - of all
+    string db_path;
+    LMDB_DESCRIPTOR lmdb;            // files and items of all shards, for the progress
+    vector< shared_ptr<SHARD> > shards;
+    bool sharded;                    // shards live in db_path, described by index
+    SHARD_INDEX index;
+    boost::atomic<size_t> next_shard; // round-robin placement
+    shared_ptr<IMAGE_STATS> stats;   // of the images written, NULL - not gathered
+    const KEY_PERMUTATION* permutation; // item_no -> key, NULL - keys follow item_no
+
+    OUTPUT_DB(LABEL_SET set, int side, size_t side_index, int split_index, const string& path) :
+        label_set(set), size(side), size_index(side_index), split(split_index), db_path(path), sharded(false),
+        next_shard(0),
+        permutation(NULL) {}
+
+    size_t placeShard(const string& name) // shard for a new image
+    {
+        if (shards.size() == 1)
+            return 0;
+        if (index.placement == HASH_PLACEMENT)
+            return hashFileContents(name.data(), name.size()) % shards.size();
+        return next_shard.fetch_add(1, boost::memory_order_relaxed) % shards.size();
+    }
+};
 
-    for(int y = 0; y < img.size().height; ++y)
+typedef vector< shared_ptr<OUTPUT_DB> > OUTPUT_LIST;
+
+struct IMAGE_RECORD // single bmp file travelling through the conversion pipeline, recycled afterwards
+{
+    path file;
+    string source;                   // file path relative to the converted directory, manifest key
+    MANIFEST_ENTRY origin;           // size, mtime and hash of the file
+    char labels[MAX_OUTPUTS];        // class per output database, -1 - the image does not go there
+    size_t shards[MAX_OUTPUTS];      // shard per output database, shard count - not placed yet
+    int items[MAX_OUTPUTS];          // item_no per output database given in scan order, -1 - given when serialized
+    string replaces[MAX_OUTPUTS];    // per output database: key of the record made from an older version of the file
+    vector<uchar> file_data;         // raw bytes read from disk
+    vector<uchar> gray_data;         // pixels of the natively decoded image, img points here
+    Mat img;                         // decoded image
+    vector< vector<uchar> > lenet;   // LeNet image per output size
+
+    IMAGE_RECORD()
     {
-        img_ptr = img.ptr(y);
-        for(int x = 0; x < img.size().width; ++x)
-        {
-            if (img_ptr[x] > 0)
-            {
-                blob_points++;
-                if (bounds.x > x)
-                    bounds.x = x;
-                if (bounds.width < x)
-                    bounds.width = x;
-                if (bounds.y > y)
-                    bounds.y = y;
-                if (bounds.height < y)
-                    bounds.height = y;
-                centroid += Point2f(x,y);
-            }
-        }
+        std::fill(labels, labels + MAX_OUTPUTS, -1);
     }
+    bool routed() const // goes to at least one database
+    {
+        for (int i = 0; i < MAX_OUTPUTS; ++i)
+            if (labels[i] != -1)
+                return true;
+        return false;
+    }
+};
 
-    bounds.height -= (bounds.y-1);
-    bounds.width -= (bounds.x-1);
-    centroid = (centroid*(1./static_cast<float>(blob_points)))-Point2f(bounds.x, bounds.y);
+typedef BOUNDED_QUEUE<IMAGE_RECORD*> RECORD_QUEUE;
+typedef OBJECT_POOL<IMAGE_RECORD> RECORD_POOL;
 
-    //    cout << "bounds.x = " << bounds.x << endl
-    //         << "bounds.y = " << bounds.y << endl
-    //         << "bounds.height = " << bounds.height << endl
-    //         << "bounds.width = " << bounds.width << endl
-    //         << "Found " << blob_points << " points" << endl
-    //         << "Center of masses " << centroid;
-}
+struct PROGRESS_COUNTERS // bumped by the workers, read by the progress reporter only
+{
+    boost::atomic<uint64_t> files_found; // bmp files handed to the pipeline
+    boost::atomic<uint64_t> bytes_read;
+    boost::atomic<bool> scan_finished;
+
+    PROGRESS_COUNTERS() : files_found(0), bytes_read(0), scan_finished(false) {}
+};
+
+PROGRESS_COUNTERS progress;
 
-char getClassNumbers(char label) // returns the class of the given character with respect to digits set
-                                // based on ASCII characters
-                                // 11 - unknown class
+int64_t modificationTime(const struct stat& st) // nanoseconds
 {
-    char res = static_cast<int>(label)-48;
-    if ((res > 10) || (res < 0))
-            res = -1;
-    return res;
+#ifdef __linux__
+    return static_cast<int64_t>(st.st_mtim.tv_sec)*1000000000 + st.st_mtim.tv_nsec;
+#else
+    return static_cast<int64_t>(st.st_mtime)*1000000000;
+#endif
 }
 
-char getClassCapLetters(char label) // returns the class of the given character with respect to capital letters set
-                                   // based on ASCII characters
-                                   // 26 - unknown class
+bool unchangedSince(const MANIFEST_ENTRY* entry, const struct stat& st) // same file as at its last conversion
 {
-    char res = static_cast<int>(label)-65;
-    if ((res > 25) || (res < 0))
-            res = -1;
-    return res;
+    return entry->size == static_cast<uint64_t>(st.st_size) && entry->mtime == modificationTime(st);
 }
 
-char getClassSmallLetters(char label) // returns the class of the given character with respect to small letters set
-                                   // based on ASCII characters
-                                   // 26 - uknkown class
+const MANIFEST_ENTRY* findConverted(OUTPUT_DB* output, const string& source, size_t& shard) // entry of a file converted
+                                                                                          // before, NULL - a new one
 {
-    char res = static_cast<int>(label)-97;
-    if ((res > 25) || (res < 0))
-            res = -1;
-    return res;
+    for (size_t k = 0; k < output->shards.size(); ++k)
+    {
+        const MANIFEST_ENTRY* entry = output->shards[k]->manifest.find(source);
+        if (entry)
+        {
+            output->shards[k]->manifest.markSeen(entry); // even if it cannot be read now, its record is kept
+            shard = k;
+            return entry;
+        }
+    }
+    return NULL;
 }
 
-int argToClass(char c)
+void skipOutput(OUTPUT_LIST* outputs, IMAGE_RECORD* record, size_t i) // the image does not go to output i after all
 {
-
-    switch(c)
+    if (record->items[i] != -1) // its key is given up, so the writer does not wait for it
     {
-        case 'd':  // digits
-        case 'D':
-            return DIGITS;
-
-        case 's':  // small letters
-        case 'S':
-            return SMALL_LETTERS;
-
-        case 'c':
-        case 'C':
-            return CAP_LETTERS;
-
+        DB_RECORD* skip = new DB_RECORD();
+        skip->kind = DB_RECORD::SKIP;
+        skip->item_no = record->items[i];
+        (*outputs)[i]->shards[record->shards[i]]->writer->push(skip);
+        record->items[i] = -1;
     }
+    record->labels[i] = -1;
+}
 
-    return -1;
+bool dropRecord(OUTPUT_LIST* outputs, IMAGE_RECORD* record) // the image goes nowhere, returns false for the stage
+{
+    for (size_t i = 0; i < outputs->size(); ++i)
+        if (record->labels[i] != -1)
+            skipOutput(outputs, record, i);
+    return false;
 }
 
-string classToString(int c)
+bool readFile(OUTPUT_LIST* outputs, IMAGE_RECORD* record) // I/O stage: loads the whole file into memory,
+                                                          //unless every database it goes to has it converted already
 {
+    SCOPED_TIMER timer(TIMER_READ);
+    bool tracked = FLAGS_manifest && !record->source.empty();
+    const MANIFEST_ENTRY* known[MAX_OUTPUTS] = {NULL};
+    size_t known_shard[MAX_OUTPUTS];
+    for (size_t i = 0; i < outputs->size(); ++i)
+    {
+        OUTPUT_DB* output = (*outputs)[i].get();
+        record->replaces[i].clear();
+        if (!tracked || record->labels[i] == -1)
+            continue;
+        known[i] = findConverted(output, record->source, known_shard[i]);
+        if (known[i] && record->shards[i] == output->shards.size()) // not placed yet, a converted file stays in its shard
+            record->shards[i] = known_shard[i];
+    }
 
-    switch(c)
+    int fd = open(record->file.c_str(), O_RDONLY);
+    if (fd < 0)
     {
-        case DIGITS:
-            return "DIGITS";
+        LOG(INFO) << record->file.string() << " cannot be opened" << std::endl;
+        return dropRecord(outputs, record);
+    }
 
-        case SMALL_LETTERS:
-            return "SMALL_LETTERS";
+    struct stat st;
+    bool ok = (fstat(fd, &st) == 0);
+    for (size_t i = 0; ok && i < outputs->size(); ++i)
+        if (known[i] && unchangedSince(known[i], st))
+        {
+            skipOutput(outputs, record, i);
+            (*outputs)[i]->lmdb.increaseUnchanged();
+        }
+    if (ok && !record->routed())
+    {
+        close(fd);
+        return false;
+    }
+    if (ok)
+    {
+        record->file_data.resize(st.st_size); // keeps capacity of the recycled record
+        size_t done = 0;
+        while (ok && done < record->file_data.size())
+        {
+            ssize_t n = read(fd, &record->file_data[done], record->file_data.size() - done);
+            if (n <= 0)
+                ok = false;
+            else
+                done += n;
+        }
+        progress.bytes_read.fetch_add(done, boost::memory_order_relaxed);
+    }
+    close(fd);
 
-        case CAP_LETTERS:
-            return "CAP_LETTERS";
+    if (!ok)
+    {
+        LOG(INFO) << record->file.string() << " cannot be read" << std::endl;
+        return dropRecord(outputs, record);
     }
 
-    return "INCORRECT";
+    if (tracked)
+    {
+        record->origin.size = st.st_size;
+        record->origin.mtime = modificationTime(st);
+        record->origin.hash = 0;
+        for (size_t i = 0; i < outputs->size() && !record->origin.hash; ++i)
+            if (known[i] && record->labels[i] != -1 && known[i]->size == record->origin.size &&
+                    !record->file_data.empty()) // only an older version of the same size can have the same bytes
+                record->origin.hash = hashFileContents(&record->file_data[0], record->file_data.size());
+        for (size_t i = 0; i < outputs->size(); ++i)
+        {
+            if (!known[i] || record->labels[i] == -1)
+                continue;
+            SHARD* shard = (*outputs)[i]->shards[known_shard[i]].get();
+            if (known[i]->hash && known[i]->hash == record->origin.hash) // touched, but the same bytes
+            {
+                DB_RECORD* touch = new DB_RECORD();
+                touch->kind = DB_RECORD::TOUCH;
+                touch->source = record->source;
+                touch->origin = record->origin;
+                touch->origin.key = known[i]->key;
+                shard->writer->push(touch);
+                (*outputs)[i]->lmdb.increaseUnchanged();
+                skipOutput(outputs, record, i);
+            }
+            else if (record->shards[i] == known_shard[i])
+                record->replaces[i] = known[i]->key;
+            else // placed in another shard this time, the old record goes away on its own
+            {
+                DB_RECORD* remove = new DB_RECORD();
+                remove->kind = DB_RECORD::REMOVE;
+                remove->key = known[i]->key;
+                remove->source = record->source;
+                shard->writer->push(remove);
+            }
+        }
+    }
+    for (size_t i = 0; i < outputs->size(); ++i)
+        if (record->labels[i] != -1 && record->shards[i] == (*outputs)[i]->shards.size())
+            record->shards[i] = (*outputs)[i]->placeShard(record->source.empty() ? record->file.string() :
+                                                                                    record->source);
+    return record->routed();
 }
 
-int convertImageToLeNet(Mat& img) // opens bitmap file and returns byte array with the pixels of transformed image
+bool decodeImage(OUTPUT_LIST* outputs, IMAGE_RECORD* record) // CPU stage: bmp bytes to grayscale image
 {
-    Rect bounds;
-    Point2f cm;
-
-    bitwise_not(img, img); // color inversion for LeNet
-
-    findBlobParams(img, bounds, cm);  //finds certain character position
-
-    int max_side = static_cast<int>((max(bounds.width, bounds.height))*SCALE_FACTOR); // image should have sides equal to maximum side of character's frame
-
-    try
+    SCOPED_TIMER timer(TIMER_DECODE);
+    if (record->file_data.empty())
+        return dropRecord(outputs, record);
+
+    int width, height;
+    if (FLAGS_native_bmp &&
+            decodeBmpGray(&record->file_data[0], record->file_data.size(), record->gray_data, width, height))
+        record->img = Mat(height, width, CV_8UC1, &record->gray_data[0]); // no copy, no allocation
+    else // unusual bmp variant, let OpenCV handle it
+        record->img = imdecode(Mat(1, record->file_data.size(), CV_8UC1, &record->file_data[0]),
+                               CV_LOAD_IMAGE_GRAYSCALE);
+    if (record->img.empty())
     {
-        Mat characterImage = Mat::zeros(max_side, max_side, img.type()); // here we will store image that is compatible with LeNet
-        Point2i disp = (Point2f(0.5*max_side, 0.5*max_side)-cm);// displacement of centroid
+        LOG(INFO) << record->file.string() << " cannot be decoded" << std::endl;
+        return dropRecord(outputs, record);
+    }
+    return true;
+}
 
-        int yieldX = characterImage.size().width - (disp.x + bounds.width); // cut the boundaries,
-        int yieldY = characterImage.size().height - (disp.y + bounds.height); // if cut image does not fit destination image
-        if (yieldX < 0)
-            bounds.width += yieldX;
-        if (yieldY < 0)
-            bounds.height += yieldY;
+boost::thread_specific_ptr< vector<RESAMPLE_SCRATCH> > resample_scratch; // one per preprocess thread and output size
 
-        if (disp.x < 0)
-            disp.x = 0;
-        if (disp.y < 0)
-            disp.y = 0;
+bool preprocessImage(OUTPUT_LIST* outputs, const vector<int>* sizes, IMAGE_RECORD* record) // CPU stage: img to the LeNet images
+{
+    if (!resample_scratch.get())
+        resample_scratch.reset(new vector<RESAMPLE_SCRATCH>(sizes->size()));
 
-        cv::Mat destinationROI = characterImage( Rect(disp.x, disp.y, bounds.width, bounds.height) ); // select region of character
-        cv::Mat sourceROI =  img( bounds ); // select region of character
-        sourceROI.copyTo(destinationROI); // copy character to characterImage
-        resize(characterImage, img, Size(IMAGE_SIZE,IMAGE_SIZE)); // resize to desired size
+    CANVAS_PLACEMENT placement; // blob and centroid are measured once for all sizes
+    int placed;
+    {
+        SCOPED_TIMER timer(TIMER_BLOB);
+        placed = placeCharacter(record->img, FLAGS_pad, placement);
     }
-    catch (cv::Exception)
+    if (placed == -1)
     {
-        return -1;
+        LOG(INFO) << record->file.string() << " abnormal" << std::endl;
+        return dropRecord(outputs, record);
     }
 
-
-    return 0;
-}
-
-char getLabel(string path, LABEL_SET type) // returns class of the label
-{
-    split_vector_type SplitVec;
-    split( SplitVec, path, is_any_of("_"), token_compress_on );
-    char clabel = SplitVec[SplitVec.size()-2].c_str()[0]; // get a label of image
-    switch (type)
-    {
-        case DIGITS:
-            return getClassNumbers(clabel);
-        case CAP_LETTERS:
-            return getClassCapLetters(clabel);
-        case SMALL_LETTERS:
-            return getClassSmallLetters(clabel);
+    bool needed[MAX_OUTPUTS] = {false}; // sizes some database still waits for
+    for (size_t i = 0; i < outputs->size(); ++i)
+        if (record->labels[i] != -1)
+            needed[(*outputs)[i]->size_index] = true;
+    record->lenet.resize(sizes->size());
+    for (size_t k = 0; k < sizes->size(); ++k)
+    {
+        if (!needed[k])
+            continue;
+        int size = (*sizes)[k];
+        record->lenet[k].resize(size*size); // no-op for a recycled record, unless its pixels went to a writer
+        SCOPED_TIMER timer(TIMER_RESIZE);
+        cropPadResize(record->img.ptr(), record->img.step, placement, size, &record->lenet[k][0],
+                      (*resample_scratch)[k]);
     }
+    return true;
 }
 
-void safeStoreToDB(LMDB_DESCRIPTOR* lmdb, string& value, string& keystr)
+void checkDatumEncoder(int size) // the hand-made encoding has to stay what caffe::Datum writes and reads
 {
-    lmdb->lock(); //Create thread-safe access to lmdb
-    lmdb->mdb_data.mv_size = value.size();
-    lmdb->mdb_data.mv_data = reinterpret_cast<void*>(&value[0]);
-    lmdb->mdb_key.mv_size = keystr.size();
-    lmdb->mdb_key.mv_data = reinterpret_cast<void*>(&keystr[0]);
-    CHECK_EQ(mdb_put(lmdb->mdb_txn, lmdb->mdb_dbi, &lmdb->mdb_key, &lmdb->mdb_data, 0), MDB_SUCCESS)
-        << "mdb_put failed";
-    lmdb->unlock(); //Unlock access to lmdb
-}
+    vector<uchar> pixels(size*size);
+    for (size_t i = 0; i < pixels.size(); ++i)
+        pixels[i] = static_cast<uchar>(i*7);
+    DATUM_SHAPE shape;
+    shape.channels = 1;
+    shape.height = size;
+    shape.width = size;
+    shape.label = 61;
 
-void lmdbThread(LMDB_DESCRIPTOR* lmdb, const path* p)///LMDB_DESCRIPTOR &lmdb, path p) //separate thread for working with certain folder
-{
-    // Caffe neural network blob
     Datum datum;
-    datum.set_channels(1);
-    datum.set_height(IMAGE_SIZE);
-    datum.set_width(IMAGE_SIZE);
+    datum.set_channels(shape.channels);
+    datum.set_height(shape.height);
+    datum.set_width(shape.width);
+    datum.set_data(&pixels[0], pixels.size());
+    datum.set_label(shape.label);
+    string expected;
+    datum.SerializeToString(&expected);
+
+    vector<uchar> encoded(datumWireSize(shape, pixels.size()));
+    CHECK(encodeDatum(shape, &pixels[0], pixels.size(), &encoded[0]) == &encoded[0] + encoded.size() &&
+          expected == string(encoded.begin(), encoded.end()))
+        << "Datum encoder does not match caffe::Datum, run with --reserve=false";
+}
 
-    // Additional variables
-    char *pixels, label;                  // image and class
+bool serializeRecord(OUTPUT_LIST* outputs, IMAGE_RECORD* record) // last CPU stage: builds Datum and hands it to the writers
+{
+    SCOPED_TIMER timer(TIMER_SERIALIZE);
     const int kMaxKeyLength = 10;         // maximum number of character in key
     char key_cstr[kMaxKeyLength];
-    int item_no = 0;
-    string value;
-    vec dir_elements;
+    for (size_t i = 0; i < outputs->size(); ++i)
+    {
+        if (record->labels[i] == -1)
+            continue;
+        OUTPUT_DB* output = (*outputs)[i].get();
+        SHARD* shard = output->shards[record->shards[i]].get();
+        const vector<uchar>& lenet = record->lenet[output->size_index];
+        int item_no = record->items[i] != -1 ? record->items[i] : // deterministic order
+                      shard->lmdb.reserveItem(FLAGS_key_block, shard->writer.get()); // from the thread's own block
+
+        if (output->stats)
+            output->stats->add(&lenet[0], record->labels[i]);
+
+        DB_RECORD* db_record = new DB_RECORD();
+        if (FLAGS_reserve) // the pixels go to the writer as they are, it encodes the Datum straight into the page
+        {
+            db_record->datum = true;
+            db_record->shape.channels = 1;
+            db_record->shape.height = output->size;
+            db_record->shape.width = output->size;
+            db_record->shape.label = record->labels[i];
+            bool last_use = true; // of this size, the other databases of the size need the pixels too
+            for (size_t j = i + 1; j < outputs->size() && last_use; ++j)
+                last_use = record->labels[j] == -1 || (*outputs)[j]->size_index != output->size_index;
+            if (last_use)
+                db_record->pixels.swap(record->lenet[output->size_index]); // no copy
+            else
+                db_record->pixels.assign(lenet.begin(), lenet.end());
+        }
+        else
+        {
+            // Caffe neural network blob
+            Datum datum;
+            datum.set_channels(1);
+            datum.set_height(output->size);
+            datum.set_width(output->size);
+            datum.set_data(&lenet[0], lenet.size());
+            datum.set_label(record->labels[i]);
+            datum.SerializeToString(&db_record->value);
+        }
+        snprintf(key_cstr, kMaxKeyLength, "%08d", output->permutation ? // shuffled: caffe reads it in random order
+                 static_cast<int>(output->permutation->forward(item_no)) : item_no);
+        db_record->key = key_cstr;
+        db_record->item_no = item_no;
+        db_record->source = record->source;
+        db_record->origin = record->origin;
+        db_record->replaces = record->replaces[i];
+        shard->writer->push(db_record); // lock-free, the writer thread owns the transaction
+    }
+    return false; // the image record is done with, the stage frees it
+}
 
-    copy(directory_iterator(*p), directory_iterator(), back_inserter(dir_elements));
+string relativeSource(const string& root, const string& name) // manifest key of a file, empty - outside root
+{
+    if (name.compare(0, root.size(), root) != 0)
+        return string();
+    size_t from = root.size(); // relative, so the tree may be moved
+    while (from < name.size() && name[from] == '/')
+        from++;
+    return name.substr(from);
+}
 
-    for (vec::const_iterator it (dir_elements.begin()); it != dir_elements.end(); ++it)
+void enqueueFile(OUTPUT_LIST* outputs, RECORD_POOL* records, RECORD_QUEUE* files, const string& root, bool ordered,
+                 const DATASET_SPLIT* splitting, int split,
+                 const string& name) //called by the walker for every regular file,
+                                     //bmp files go to the pipeline as soon as they are found
+                                     //ordered - files come one by one in a fixed order, shards and keys are given here
+                                     //split - given by the caller, -1 - follows from the path
+{
+    if ((name.size()>3) &&
+            (name.compare(name.size()-3, 3, "bmp") == 0)) //find bmp file
     {
-        string name = it->string();
-
-        if ((is_regular_file(*it)))
+        string source = relativeSource(root, name);
+        if (splitting && split == -1)
+            split = splitting->byPath(source.empty() ? name : source);
+        char clabel = getLabelChar(name);
+        char labels[MAX_OUTPUTS];
+        bool routed = false;
+        for (size_t i = 0; i < outputs->size(); ++i)
         {
-            lmdb->increaseCurrentFileIndex();
-            if ((name.size()>3) &&
-                    (name.compare(name.size()-3, 3, "bmp") == 0)) //find bmp file
+            OUTPUT_DB* output = (*outputs)[i].get();
+            labels[i] = (output->split == -1 || output->split == split) ? labelToClass(clabel, output->label_set) : -1;
+            if (labels[i] != -1)
             {
-                label = getLabel(name, TARGET_SET);
+                routed = true;
+                (*outputs)[i]->lmdb.increaseCurrentFileIndex(); // running total for the progress
+            }
+        }
 
-                if (label == -1)
+        size_t shards[MAX_OUTPUTS];
+        for (size_t i = 0; i < outputs->size(); ++i)
+            shards[i] = (*outputs)[i]->shards.size();
+        if (routed && ordered && FLAGS_manifest && !source.empty()) // keys only for files that may be stored,
+        {                                                            // a converted file stays in its shard
+            const MANIFEST_ENTRY* known[MAX_OUTPUTS] = {NULL};
+            bool any_known = false;
+            for (size_t i = 0; i < outputs->size(); ++i)
+                if (labels[i] != -1)
                 {
-                    //LOG(INFO) << "not passed"<< std::endl;
-                    continue;
+                    known[i] = findConverted((*outputs)[i].get(), source, shards[i]);
+                    any_known = any_known || known[i];
                 }
-//                LOG(INFO) << "passed"<< std::endl;
+            struct stat st;
+            if (any_known && stat(name.c_str(), &st) == 0) // unreadable ones are left to the read stage
+            {
+                routed = false;
+                for (size_t i = 0; i < outputs->size(); ++i)
+                    if (known[i] && unchangedSince(known[i], st))
+                    {
+                        labels[i] = -1;
+                        (*outputs)[i]->lmdb.increaseUnchanged();
+                    }
+                    else
+                        routed = routed || labels[i] != -1;
+            }
+        }
 
-                Mat img(imread(name, CV_LOAD_IMAGE_GRAYSCALE)); // image from name
-                if (convertImageToLeNet(img) == -1) //replace img by the LeNet img
-                {
-                    LOG(INFO) << name << " abnormal" << std::endl;
-                    continue;
-                }
-                pixels = reinterpret_cast<char*> (img.ptr());
-
-                item_no = lmdb->increaseItemsCounter();
-                datum.set_data(pixels, IMAGE_SIZE*IMAGE_SIZE);
-                datum.set_label(label);
-                snprintf(key_cstr, kMaxKeyLength, "%08d", item_no);
-                datum.SerializeToString(&value);
-                string keystr(key_cstr);
-                safeStoreToDB(lmdb, value, keystr);
-
-                if (item_no%DISPLAY_PERIOD == 0)
-                    LOG(INFO) << lmdb->getFileIndex() << '('<< item_no << " items) out of "<< lmdb->files_number << '('
-                              << static_cast<float>(lmdb->getFileIndex())/lmdb->files_number*100 << "%) files have been processed." << std::endl;
+        if (!routed)
+        {
+            //LOG(INFO) << "not passed"<< std::endl;
+            return;
+        }
+//        LOG(INFO) << "passed"<< std::endl;
+
+        IMAGE_RECORD* record = records->acquire();
+        record->file = name;
+        record->source = source;
+        std::fill(record->labels, record->labels + MAX_OUTPUTS, -1);
+        std::copy(labels, labels + outputs->size(), record->labels);
+        for (size_t i = 0; i < outputs->size(); ++i)
+        {
+            OUTPUT_DB* output = (*outputs)[i].get();
+            record->shards[i] = shards[i];
+            record->items[i] = -1;
+            if (ordered && labels[i] != -1) // the same for any number of threads
+            {
+                if (record->shards[i] == output->shards.size())
+                    record->shards[i] = output->placeShard(record->source.empty() ? name : record->source);
+                record->items[i] = output->shards[record->shards[i]]->lmdb.increaseItemsCounter();
             }
         }
+        progress.files_found.fetch_add(1, boost::memory_order_relaxed);
+        files->push(record); // blocks while the readers are behind
     }
+}
 
-//    LOG(INFO) << "End thread in " << *p << " folder";
+void sampleProgress(OUTPUT_LIST* outputs, RECORD_POOL* records, RECORD_QUEUE* files, RECORD_QUEUE* raw,
+                    RECORD_QUEUE* decoded, RECORD_QUEUE* preprocessed,
+                    PROGRESS_SAMPLE& sample) // reporter thread, workers are never held up by it
+{
+    sample.files_done = records->released(); // before files_found, so it never overtakes it
+    sample.scan_finished = progress.scan_finished.load(boost::memory_order_acquire);
+    sample.files_found = progress.files_found.load(boost::memory_order_relaxed);
+    sample.bytes_read = progress.bytes_read.load(boost::memory_order_relaxed);
+    size_t writer_depth = 0;
+    sample.records_written = 0;
+    for (size_t i = 0; i < outputs->size(); ++i)
+        for (size_t k = 0; k < (*outputs)[i]->shards.size(); ++k)
+        {
+            const LMDB_WRITER* writer = (*outputs)[i]->shards[k]->writer.get();
+            sample.records_written += writer->written();
+            writer_depth += writer->depth();
+        }
+    sample.queues.clear();
+    sample.queues.push_back(std::make_pair(string("read"), files->size()));
+    sample.queues.push_back(std::make_pair(string("decode"), raw->size()));
+    sample.queues.push_back(std::make_pair(string("preprocess"), decoded->size()));
+    sample.queues.push_back(std::make_pair(string("serialize"), preprocessed->size()));
+    sample.queues.push_back(std::make_pair(string("write"), writer_depth));
+}
 
+struct FILE_LIST // files found by the walker, converted once the scan is over
+{
+    mutex mtx_;
+    vector<string> names;
+};
+
+void collectFile(FILE_LIST* found, const string& name) // called by the walker for every regular file
+{
+    if ((name.size()>3) &&
+            (name.compare(name.size()-3, 3, "bmp") == 0))
+    {
+        found->mtx_.lock();
+        found->names.push_back(name);
+        found->mtx_.unlock();
+    }
+}
+
+size_t stageThreads(int flag_value) // 0 - one thread per hardware thread
+{
+    if (flag_value > 0)
+        return flag_value;
+    size_t n = boost::thread::hardware_concurrency();
+    return n ? n : 1;
 }
 
-ulong getFilesNumber(const path& p)
+void checkShuffleSeed(const string& db_path, bool created) // a database keeps the permutation it was shuffled with
 {
-    vec dir_elements;
-    ulong elements_number = 0;
-    LOG(INFO) << "Counting files within folders..."<< std::endl;
-    copy(directory_iterator(p), directory_iterator(), back_inserter(dir_elements));
-    for(vec::const_iterator it=dir_elements.begin(); it != dir_elements.end(); ++it)
-        if (is_directory(*it))
+    string file_name = db_path + "/" SHUFFLE_FILE_NAME;
+    if (created)
+    {
+        if (FLAGS_shuffle)
         {
-            vec dir_elements_within;
-            copy(directory_iterator(*it), directory_iterator(), back_inserter(dir_elements_within));
-            elements_number += dir_elements_within.size();
+            std::ofstream out(file_name.c_str());
+            out << FLAGS_seed << '\n';
+            CHECK(out.good()) << "Cannot write " << file_name;
         }
-    LOG(INFO) << "Counting is finished. " << elements_number << " files are found." << std::endl;
-    return elements_number;
+        return;
+    }
+    std::ifstream in(file_name.c_str());
+    uint64_t seed = 0;
+    bool shuffled = static_cast<bool>(in >> seed);
+    CHECK_EQ(shuffled, FLAGS_shuffle) << db_path << (shuffled ? " is shuffled, rerun with --shuffle" :
+                                                                " is not shuffled, rerun without --shuffle");
+    CHECK(!shuffled || seed == FLAGS_seed) << db_path << " is shuffled with --seed " << seed;
+}
+
+void openShard(SHARD* output, const KEY_PERMUTATION* permutation) // creates or reopens the database, rolls an interrupted one back, starts its writer
+{
+    LMDB_DESCRIPTOR* lmdb = &output->lmdb;
+    MANIFEST& manifest = output->manifest;
+    const char* db_path = output->db_path.c_str();
+
+    output->update = FLAGS_manifest && exists(path(db_path));
+    if (output->update) // rerun: convert the changes only
+    {
+        CHECK(manifest.exists()) << db_path << " exists, but has no " MANIFEST_FILE_NAME
+                                 << ", so it cannot be updated";
+        CHECK(FLAGS_resume || !manifest.interrupted()) << "Conversion to " << db_path
+                                 << " has been interrupted, rerun with --resume to continue it";
+    }
+    else
+    {
+        CHECK(!FLAGS_resume || FLAGS_manifest) << "--resume needs the manifest";
+        LOG(INFO) << "Opening lmdb " << db_path;
+        CHECK_EQ(mkdir(db_path, 0744), 0)
+            << "mkdir " << db_path << "failed";
+        if (FLAGS_manifest)
+            manifest.create();
+    }
+    checkShuffleSeed(output->db_path, !output->update);
+    CHECK_EQ(mdb_env_create(&lmdb->mdb_env), MDB_SUCCESS) << "mdb_env_create failed";
+    CHECK_EQ(mdb_env_set_mapsize(lmdb->mdb_env, 1099511627776), MDB_SUCCESS)  // 1TB
+        << "mdb_env_set_mapsize failed";
+    CHECK_EQ(mdb_env_open(lmdb->mdb_env, db_path, 0, 0664), MDB_SUCCESS)
+        << "mdb_env_open failed";
+    MDB_txn *mdb_txn;
+    CHECK_EQ(mdb_txn_begin(lmdb->mdb_env, NULL, 0, &mdb_txn), MDB_SUCCESS)
+        << "mdb_txn_begin failed";
+    CHECK_EQ(mdb_open(mdb_txn, NULL, 0, &lmdb->mdb_dbi), MDB_SUCCESS)
+        << "mdb_open failed. Does the lmdb already exist? ";
+    bool resume = output->update && manifest.interrupted();
+    if (resume) // back to the last checkpoint: records committed after it go away
+    {
+        vector<string> keys;
+        manifest.uncommitted(keys);
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            MDB_val mdb_key;
+            mdb_key.mv_size = keys[i].size();
+            mdb_key.mv_data = const_cast<char*>(keys[i].data());
+            int rc = mdb_del(mdb_txn, lmdb->mdb_dbi, &mdb_key, NULL);
+            CHECK(rc == MDB_SUCCESS || rc == MDB_NOTFOUND) << "mdb_del failed";
+        }
+        LOG(INFO) << "Resuming conversion to " << db_path << ", " << keys.size()
+                  << " records past the last checkpoint are rolled back";
+    }
+    string last_key;
+    if (output->update) // new records go after the existing ones
+    {
+        MDB_cursor* cursor;
+        MDB_val mdb_key, mdb_data;
+        CHECK_EQ(mdb_cursor_open(mdb_txn, lmdb->mdb_dbi, &cursor), MDB_SUCCESS)
+            << "mdb_cursor_open failed";
+        if (!permutation && mdb_cursor_get(cursor, &mdb_key, &mdb_data, MDB_LAST) == MDB_SUCCESS)
+        {
+            last_key.assign(static_cast<const char*>(mdb_key.mv_data), mdb_key.mv_size);
+            lmdb->setFirstItem(atoi(last_key.c_str()) + 1);
+        }
+        else if (permutation) // keys are scattered, the greatest item_no is found among all of them
+        {
+            int next_item = 0;
+            for (MDB_cursor_op op = MDB_FIRST; mdb_cursor_get(cursor, &mdb_key, &mdb_data, op) == MDB_SUCCESS;
+                 op = MDB_NEXT)
+            {
+                string key(static_cast<const char*>(mdb_key.mv_data), mdb_key.mv_size);
+                next_item = max(next_item, static_cast<int>(permutation->inverse(atoi(key.c_str()))) + 1);
+            }
+            lmdb->setFirstItem(next_item);
+        }
+        mdb_cursor_close(cursor);
+    }
+    CHECK_EQ(mdb_txn_commit(mdb_txn), MDB_SUCCESS) // dbi handle stays valid for the writer
+        << "mdb_txn_commit failed";
+    if (output->update)
+    {
+        if (resume)
+            manifest.rollback(); // the journal follows the database
+        manifest.load();
+        manifest.checkpoint(false); // this run is in progress
+        LOG(INFO) << "Updating lmdb " << db_path << ", " << manifest.size() << " files converted before";
+    }
+
+    WRITER_OPTIONS writer_options;
+    writer_options.queue_capacity = FLAGS_writer_queue_depth;
+    writer_options.commit_records = FLAGS_commit_records;
+    writer_options.commit_bytes = FLAGS_commit_mb << 20;
+    writer_options.commit_seconds = FLAGS_commit_seconds;
+    writer_options.append = FLAGS_append && !permutation; // shuffled keys cannot be appended
+    writer_options.reorder_window = FLAGS_reorder_window; // fixed, it bounds the memory and the records a crash loses
+    if (FLAGS_deterministic) // every item_no arrives, as a record or a skip, the writer never gives up on one
+    {
+        writer_options.reorder_window = std::numeric_limits<size_t>::max();
+        writer_options.commit_seconds = 0; // commits at the same records every run
+    }
+    writer_options.first_item = lmdb->getFirstItem();
+    writer_options.last_key = last_key;
+    writer_options.manifest = FLAGS_manifest ? &manifest : NULL;
+    output->writer.reset(new LMDB_WRITER(lmdb->mdb_env, lmdb->mdb_dbi, writer_options));
+}
+
+void openOutput(OUTPUT_DB* output, const KEY_PERMUTATION* permutation) // lays the shards out and opens them
+{
+    const string& db_path = output->db_path;
+    output->permutation = permutation;
+    output->sharded = exists(path(db_path)) && output->index.load(db_path);
+    if (output->sharded) // existing layout wins
+    {
+        if (FLAGS_shards > 1 && static_cast<size_t>(FLAGS_shards) != output->index.names.size())
+            LOG(WARNING) << db_path << " has " << output->index.names.size() << " shards, --shards is ignored";
+    }
+    else if (FLAGS_shards > 1)
+    {
+        CHECK(!exists(path(db_path))) << db_path << " exists and is not sharded, it cannot be resharded";
+        CHECK(placementFromName(FLAGS_shard_placement, output->index.placement))
+            << "Shard placement is incorrect. Use round_robin or hash instead";
+        CHECK_EQ(mkdir(db_path.c_str(), 0744), 0)
+            << "mkdir " << db_path << "failed";
+        for (int i = 0; i < FLAGS_shards; ++i)
+            output->index.names.push_back(SHARD_INDEX::shardName(i));
+        output->index.save(db_path);
+        output->sharded = true;
+    }
+
+    if (output->sharded)
+    {
+        LOG(INFO) << db_path << ": " << output->index.names.size() << " shards, "
+                  << placementName(output->index.placement) << " placement";
+        for (size_t i = 0; i < output->index.names.size(); ++i)
+            output->shards.push_back(shared_ptr<SHARD>(new SHARD(db_path + "/" + output->index.names[i])));
+    }
+    else
+        output->shards.push_back(shared_ptr<SHARD>(new SHARD(db_path)));
+    CHECK_LE(output->shards.size(), 1000u) << "Too many shards";
+
+    for (size_t i = 0; i < output->shards.size(); ++i)
+        openShard(output->shards[i].get(), output->permutation);
+
+    bool update = false;
+    for (size_t i = 0; i < output->shards.size(); ++i)
+        update = update || output->shards[i]->update;
+    if (FLAGS_stats && !update) // an update sees only the changed images
+        output->stats.reset(new IMAGE_STATS(output->size, classCount(output->label_set)));
+    else if (FLAGS_stats)
+        LOG(INFO) << db_path << ": statistics are not gathered while a database is updated";
+}
+
+void removeUnseen(SHARD* output) // after the read stage: records of files that are gone go away
+{
+    if (!output->update)
+        return;
+    vector<pair<string, MANIFEST_ENTRY> > gone;
+    output->manifest.unseen(gone);
+    for (size_t i = 0; i < gone.size(); ++i)
+    {
+        DB_RECORD* remove = new DB_RECORD();
+        remove->kind = DB_RECORD::REMOVE;
+        remove->key = gone[i].second.key;
+        remove->source = gone[i].first;
+        output->writer->push(remove);
+    }
+}
+
+size_t closeShard(SHARD* output) // stores the rest of the records, commits and closes the database, returns its size
+{
+    LMDB_WRITER& writer = *output->writer;
+    LMDB_DESCRIPTOR* lmdb = &output->lmdb;
+    writer.finish();
+    if (FLAGS_manifest)
+    {
+        output->manifest.checkpoint(true); // everything is committed, nothing to roll back
+        output->manifest.compact();
+    }
+    MDB_stat stat;
+    CHECK_EQ(mdb_env_stat(lmdb->mdb_env, &stat), MDB_SUCCESS) << "mdb_env_stat failed";
+
+    //close db
+    mdb_close(lmdb->mdb_env, lmdb->mdb_dbi);
+    mdb_env_close(lmdb->mdb_env);
+
+    LOG(INFO) << output->db_path << ": " << writer.written() << " items have been processed and stored to the database in "
+              << writer.commits() << " commits, " << writer.appended() << " of them appended." << std::endl;
+    if (output->update)
+        LOG(INFO) << output->db_path << ": " << writer.removed() << " outdated records have been removed." << std::endl;
+    output->writer.reset();
+    return stat.ms_entries;
+}
+
+void closeOutput(OUTPUT_DB* output) // closes the shards and records their sizes in the index
+{
+    output->index.records.clear();
+    for (size_t i = 0; i < output->shards.size(); ++i)
+        output->index.records.push_back(closeShard(output->shards[i].get()));
+    if (output->sharded)
+        output->index.save(output->db_path);
+    if (FLAGS_manifest)
+        LOG(INFO) << output->db_path << ": " << output->lmdb.getUnchanged() << " files were unchanged." << std::endl;
+    if (output->stats)
+    {
+        output->stats->writeMean(output->db_path + "/" MEAN_FILE_NAME);
+        output->stats->writeJson(output->db_path + "/" STATS_FILE_NAME);
+        LOG(INFO) << output->db_path << ": mean image and statistics of " << output->stats->images()
+                  << " images have been written." << std::endl;
+    }
 }
 
 int main(int argc, char* argv[])
 {
+    gflags::SetUsageMessage("Usage: bmp_converter [FLAGS] <path> <target_sets> <db>\n"
+                            "target_sets: one or more of d (digits), c (capital letters), s (small letters),\n"
+                            "a (all 62 classes); with several sets <db>_digits, <db>_capitals, <db>_small\n"
+                            "and <db>_all are written in a single pass; --split adds <db>_train, <db>_val, ...\n"
+                            "       bmp_converter --merge <sharded_db> <db>");
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    STAGE_TIMERS::instance().enable(FLAGS_timing);
+    if (FLAGS_merge) // shards -> single database, nothing is converted
+    {
+        if (argc < 3)
+        {
+            cout << "Usage: bmp_converter --merge <sharded_db> <db>\n";
+            return 1;
+        }
+        WRITER_OPTIONS writer_options;
+        writer_options.queue_capacity = FLAGS_writer_queue_depth;
+        writer_options.commit_records = FLAGS_commit_records;
+        writer_options.commit_bytes = FLAGS_commit_mb << 20;
+        writer_options.commit_seconds = FLAGS_commit_seconds;
+        writer_options.reorder_window = FLAGS_reorder_window;
+        size_t merged = mergeShards(argv[1], argv[2], writer_options);
+        LOG(INFO) << merged << " records of " << argv[1] << " have been merged into " << argv[2] << std::endl;
+        return 0;
+    }
     if (argc < 4)
     {
-        cout << "Usage: bmp_converter <path> <target_set> <db>\n";
+        cout << "Usage: bmp_converter [FLAGS] <path> <target_sets> <db>\n";
         return 1;
     }
 
+    vector<int> sizes;
+    split_vector_type size_list;
+    split(size_list, FLAGS_size, is_any_of(","), token_compress_on);
+    for (size_t i = 0; i < size_list.size(); ++i)
+    {
+        int size = atoi(size_list[i].c_str());
+        CHECK_GT(size, 0) << "--size should be positive";
+        CHECK(std::find(sizes.begin(), sizes.end(), size) == sizes.end()) << "Size " << size << " is given twice";
+        sizes.push_back(size);
+    }
+    CHECK_GT(FLAGS_pad, 0) << "--pad should be positive";
+
     path p (argv[1]);
-    int target = argToClass(argv[2][0]);
-    CHECK_NE(target, -1)
-            << "Target set is incorrect. Use d, c, s instead\n";
-    LOG(INFO) << "Target set is: " << classToString(target) << "\n";
-    TARGET_SET = static_cast<LABEL_SET> (target);
+    string targets(argv[2]), db_name(argv[3]);
+    vector<LABEL_SET> sets;
+    for (size_t i = 0; i < targets.size(); ++i)
+    {
+        int target = argToClass(targets[i]);
+        CHECK_NE(target, -1)
+                << "Target set is incorrect. Use d, c, s, a instead\n";
+        CHECK(std::find(sets.begin(), sets.end(), target) == sets.end())
+                << "Target set " << targets[i] << " is given twice\n";
+        LOG(INFO) << "Target set is: " << classToString(target) << "\n";
+        sets.push_back(static_cast<LABEL_SET> (target));
+    }
+    CHECK(!sets.empty()) << "Target set is missing\n";
+    DATASET_SPLIT splitting;
+    if (!FLAGS_split.empty())
+        CHECK(splitting.parse(FLAGS_split)) << "--split should be 2 to " << MAX_SPLITS
+                                            << " positive weights, each optionally named: name:weight";
+    CHECK(!FLAGS_stratify || !FLAGS_split.empty()) << "--stratify needs --split";
+    size_t split_count = splitting.size() ? splitting.size() : 1;
+    CHECK_LE(sets.size()*sizes.size()*split_count, static_cast<size_t>(MAX_OUTPUTS)) << "Too many databases for one run";
+    OUTPUT_LIST outputs;
+    for (size_t i = 0; i < sets.size(); ++i) // with several sets, sizes or splits, one database per combination
+        for (size_t k = 0; k < sizes.size(); ++k)
+            for (size_t s = 0; s < split_count; ++s)
+            {
+                string name = db_name;
+                if (sets.size() > 1)
+                    name += "_" + classToSuffix(sets[i]);
+                if (sizes.size() > 1)
+                    name += "_" + boost::lexical_cast<string>(sizes[k]);
+                if (splitting.size())
+                    name += "_" + splitting.names[s];
+                outputs.push_back(shared_ptr<OUTPUT_DB>(new OUTPUT_DB(sets[i], sizes[k], k,
+                                                                      splitting.size() ? static_cast<int>(s) : -1,
+                                                                      name)));
+            }
 
     if (exists(p))    // does p actually exist?
     {
@@ -360,51 +1025,100 @@ int main(int argc, char* argv[])
 
       else if (is_directory(p))      // is p a directory?
       {
+        if (FLAGS_reserve)
+            for (size_t i = 0; i < sizes.size(); ++i) // the data length varint grows with the side
+                checkDatumEncoder(sizes[i]);
+        KEY_PERMUTATION permutation(FLAGS_seed); // outlives the outputs
+        TIMING_REPORTER timing_reporter(FLAGS_timing && FLAGS_timing_seconds > 0 ? FLAGS_timing_seconds : 0); // the last report follows closeOutput
+        size_t writers = 0;
+        for (size_t i = 0; i < outputs.size(); ++i)
+        {
+            openOutput(outputs[i].get(), FLAGS_shuffle ? &permutation : NULL);
+            writers += outputs[i]->shards.size();
+        }
 
-        shared_ptr<LMDB_DESCRIPTOR> lmdb(new LMDB_DESCRIPTOR()); // single lmdb for whole program
-        vec dir_elements;
-
-        char *pixels, *db_path = argv[3];
-        string value;
-
-        LOG(INFO) << "Opening lmdb " << db_path;
-        CHECK_EQ(mkdir(db_path, 0744), 0)
-            << "mkdir " << db_path << "failed";
-        CHECK_EQ(mdb_env_create(&lmdb->mdb_env), MDB_SUCCESS) << "mdb_env_create failed";
-        CHECK_EQ(mdb_env_set_mapsize(lmdb->mdb_env, 1099511627776), MDB_SUCCESS)  // 1TB
-            << "mdb_env_set_mapsize failed";
-        CHECK_EQ(mdb_env_open(lmdb->mdb_env, db_path, 0, 0664), MDB_SUCCESS)
-            << "mdb_env_open failed";
-        CHECK_EQ(mdb_txn_begin(lmdb->mdb_env, NULL, 0, &lmdb->mdb_txn), MDB_SUCCESS)
-            << "mdb_txn_begin failed";
-        CHECK_EQ(mdb_open(lmdb->mdb_txn, NULL, 0, &lmdb->mdb_dbi), MDB_SUCCESS)
-            << "mdb_open failed. Does the lmdb already exist? ";
-
-        lmdb->files_number = getFilesNumber(p);
-        copy(directory_iterator(p), directory_iterator(), back_inserter(dir_elements));
-        vec::const_iterator it (dir_elements.begin());
-        while(it != dir_elements.end())
+        // pipeline: walk -> read -> decode -> preprocess -> serialize -> lmdb writers, one per database
+        RECORD_QUEUE files(FLAGS_queue_depth), raw(FLAGS_queue_depth), decoded(FLAGS_queue_depth),
+                     preprocessed(FLAGS_queue_depth);
+        RECORD_POOL records; // declared before the stages, outlives them
         {
-            boost::thread_group thread_group;
-            for(int thread_num = 0; thread_num < MAXIMUM_NUMBER_OF_THREADS && it != dir_elements.end(); ++thread_num)
+            PROGRESS_REPORTER progress_reporter(FLAGS_progress_seconds > 0 ? FLAGS_progress_seconds : 0,
+                                                boost::bind(sampleProgress, &outputs, &records, &files, &raw,
+                                                            &decoded, &preprocessed, _1)); // outlives the stages
+            PIPELINE_STAGE<IMAGE_RECORD> read_stage("read", &files, &raw, stageThreads(FLAGS_read_threads),
+                                                    boost::bind(readFile, &outputs, _1), &records);
+            PIPELINE_STAGE<IMAGE_RECORD> decode_stage("decode", &raw, &decoded, stageThreads(FLAGS_decode_threads),
+                                                      boost::bind(decodeImage, &outputs, _1), &records);
+            PIPELINE_STAGE<IMAGE_RECORD> preprocess_stage("preprocess", &decoded, &preprocessed,
+                                                          stageThreads(FLAGS_preprocess_threads),
+                                                          boost::bind(preprocessImage, &outputs, &sizes, _1),
+                                                          &records);
+            PIPELINE_STAGE<IMAGE_RECORD> serialize_stage("serialize", &preprocessed, NULL,
+                                                         stageThreads(FLAGS_serialize_threads),
+                                                         boost::bind(serializeRecord, &outputs, _1),
+                                                         &records);
+            LOG(INFO) << "Blob kernel: " << blobKernelName() << std::endl;
+            for (size_t k = 0; k < sizes.size(); ++k)
+                LOG(INFO) << "Resample kernel: " << (resampleKernelIsSpecialised(sizes[k]) ? "specialised " : "generic ")
+                          << sizes[k] << "x" << sizes[k] << std::endl;
+            LOG(INFO) << "Pipeline threads: read " << read_stage.size() << ", decode " << decode_stage.size()
+                      << ", preprocess " << preprocess_stage.size() << ", serialize " << serialize_stage.size()
+                      << ", write " << writers << std::endl;
+
+            WORK_STEALING_POOL pool; // walks folders in parallel
+            const DATASET_SPLIT* split_by = splitting.size() ? &splitting : NULL;
+            bool collect = FLAGS_deterministic || FLAGS_stratify;
+            FILE_LIST found; // deterministic or stratified: the pipeline starts after the scan
+            DIRECTORY_WALKER walker(pool, collect ?
+                                        DIRECTORY_WALKER::FileHandler(boost::bind(collectFile, &found, _1)) :
+                                        DIRECTORY_WALKER::FileHandler(boost::bind(enqueueFile, &outputs, &records,
+                                                                                  &files, p.string(), false,
+                                                                                  split_by, -1, _1)),
+                                    FLAGS_dirent_buffer_kb << 10);
+            walker.walk(p.string()); // whole tree, not only the top-level folders
+            pool.wait(); // every bmp file is in the pipeline
+            if (collect)
             {
-                boost::thread* current_thread = new boost::thread(lmdbThread, lmdb.get(), &(*it));  //thread group frees all thread objects after destruction
-                thread_group.add_thread(current_thread); // so there is no need to manage this process
-                it++; // http://www.boost.org/doc/libs/1_35_0/doc/html/thread/thread_management.html#thread.thread_management.threadgroup.destructor
+                std::sort(found.names.begin(), found.names.end());
+                LOG(INFO) << found.names.size() << " bmp files found and sorted." << std::endl;
+                vector<int> found_splits(found.names.size(), -1);
+                if (FLAGS_stratify) // by the label character, the finest of the sets
+                {
+                    vector<string> sources(found.names.size());
+                    vector<char> strata(found.names.size());
+                    for (size_t i = 0; i < found.names.size(); ++i)
+                    {
+                        sources[i] = relativeSource(p.string(), found.names[i]);
+                        if (sources[i].empty())
+                            sources[i] = found.names[i];
+                        strata[i] = getLabelChar(found.names[i]);
+                    }
+                    splitting.stratify(sources, strata, found_splits);
+                }
+                for (size_t i = 0; i < found.names.size(); ++i)
+                    enqueueFile(&outputs, &records, &files, p.string(), FLAGS_deterministic, split_by,
+                                found_splits[i], found.names[i]);
+                vector<string>().swap(found.names);
+            }
+            progress.scan_finished.store(true, boost::memory_order_release);
+            for (size_t i = 0; i < outputs.size(); ++i)
+            {
+                LOG(INFO) << "Scan is finished, " << outputs[i]->lmdb.getFileIndex() << " bmp files of "
+                          << classToString(outputs[i]->label_set) << " found among " << walker.files()
+                          << " files in " << walker.directories() << " directories." << std::endl;
             }
-            thread_group.join_all();
+            files.close(); // stages drain their queues and stop one after another
+
+            read_stage.join();
+            for (size_t i = 0; i < outputs.size(); ++i) // every existing file is seen by now
+                for (size_t k = 0; k < outputs[i]->shards.size(); ++k)
+                    removeUnseen(outputs[i]->shards[k].get());
+            decode_stage.join();
+            preprocess_stage.join();
+            serialize_stage.join();
         }
-
-        //close db
-        CHECK_EQ(mdb_txn_commit(lmdb->mdb_txn), MDB_SUCCESS)
-            << "mdb_txn_commit failed";
-        CHECK_EQ(mdb_txn_begin(lmdb->mdb_env, NULL, 0, &lmdb->mdb_txn), MDB_SUCCESS)
-            << "mdb_txn_begin failed";
-        CHECK_EQ(mdb_txn_commit(lmdb->mdb_txn), MDB_SUCCESS) << "mdb_txn_commit failed";
-        mdb_close(lmdb->mdb_env, lmdb->mdb_dbi);
-        mdb_env_close(lmdb->mdb_env);
-
-        LOG(INFO) << lmdb->increaseItemsCounter() << " items have been processed and stored to the database." << std::endl;
+        for (size_t i = 0; i < outputs.size(); ++i)
+            closeOutput(outputs[i].get());
       }
       else
         cout << p << " exists, but is neither a regular file nor a directory\n" << std::endl;
@@ -0,0 +1,257 @@
+#include "manifest.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+uint64_t hashFileContents(const void* data, size_t size) // 64-bit FNV-1a
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void writeWholeFile(int fd, const std::string& data, const std::string& file_name)
+{
+    size_t done = 0;
+    while (done < data.size())
+    {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        CHECK_GT(n, 0) << "Cannot write " << file_name;
+        done += n;
+    }
+    CHECK_EQ(fsync(fd), 0) << "Cannot sync " << file_name;
+}
+
+static void appendEntryLine(std::ostringstream& out, const std::string& path, const MANIFEST_ENTRY& entry,
+                            char tag = '+')
+{
+    out << tag << '\t' << entry.key << '\t' << entry.size << '\t' << entry.mtime << '\t'
+        << std::hex << entry.hash << std::dec << '\t' << path << '\n';
+}
+
+static void replaceFile(const std::string& file_name, const std::string& data) // atomically
+{
+    std::string tmp_name = file_name + ".tmp";
+    int fd = open(tmp_name.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0664);
+    CHECK_GE(fd, 0) << "Cannot open " << tmp_name;
+    writeWholeFile(fd, data, tmp_name);
+    close(fd);
+    CHECK_EQ(rename(tmp_name.c_str(), file_name.c_str()), 0) << "Cannot replace " << file_name;
+}
+
+MANIFEST::MANIFEST(const std::string& db_path) :
+    file_name_(db_path + "/" MANIFEST_FILE_NAME), checkpoint_name_(db_path + "/" CHECKPOINT_FILE_NAME),
+    journal_size_(0)
+{
+}
+
+bool MANIFEST::exists() const
+{
+    struct stat st;
+    return stat(file_name_.c_str(), &st) == 0;
+}
+
+void MANIFEST::create()
+{
+    replaceFile(file_name_, std::string());
+    journal_size_ = 0;
+    checkpoint(false);
+}
+
+bool MANIFEST::readCheckpoint(uint64_t& journal_size, bool& complete) const
+{
+    std::ifstream in(checkpoint_name_.c_str());
+    int complete_flag = 0;
+    if (!(in >> journal_size >> complete_flag))
+        return false;
+    complete = complete_flag != 0;
+    return true;
+}
+
+bool MANIFEST::interrupted() const
+{
+    uint64_t journal_size;
+    bool complete;
+    if (!readCheckpoint(journal_size, complete)) // written by a version without checkpoints
+        return false;
+    return !complete;
+}
+
+void MANIFEST::uncommitted(std::vector<std::string>& keys) const
+{
+    uint64_t journal_size = 0;
+    bool complete = false;
+    readCheckpoint(journal_size, complete);
+
+    std::ifstream in(file_name_.c_str());
+    CHECK(in.good()) << "Cannot open " << file_name_;
+    in.seekg(journal_size);
+    std::string line;
+    while (std::getline(in, line))
+        if (line.size() > 2 && line[0] == '+' && line[1] == '\t')
+            keys.push_back(line.substr(2, line.find('\t', 2) - 2));
+}
+
+void MANIFEST::rollback()
+{
+    uint64_t journal_size = 0;
+    bool complete = false;
+    readCheckpoint(journal_size, complete);
+    CHECK_EQ(truncate(file_name_.c_str(), journal_size), 0) << "Cannot truncate " << file_name_;
+    journal_size_ = journal_size;
+}
+
+void MANIFEST::load()
+{
+    std::ifstream in(file_name_.c_str());
+    CHECK(in.good()) << "Cannot open " << file_name_;
+
+    boost::unordered_map<std::string, MANIFEST_ENTRY> state;
+    std::string line;
+    size_t line_no = 0;
+    while (std::getline(in, line))
+    {
+        line_no++;
+        if (line.size() < 2 || line[1] != '\t')
+            continue;
+        const char* p = line.c_str() + 2;
+        char* end;
+        if (line[0] == '+' || line[0] == '=')
+        {
+            MANIFEST_ENTRY entry;
+            const char* tab = strchr(p, '\t');
+            if (!tab)
+                continue;
+            entry.key.assign(p, tab);
+            entry.size = strtoull(tab + 1, &end, 10);
+            entry.mtime = strtoll(end + 1, &end, 10);
+            entry.hash = strtoull(end + 1, &end, 16);
+            if (*end != '\t')
+            {
+                LOG(WARNING) << file_name_ << ':' << line_no << " is malformed, skipped";
+                continue;
+            }
+            state[std::string(end + 1)] = entry;
+        }
+        else if (line[0] == '-')
+        {
+            const char* tab = strchr(p, '\t');
+            if (tab)
+                state.erase(std::string(tab + 1));
+        }
+    }
+
+    paths_.clear();
+    entries_.clear();
+    index_.clear();
+    paths_.reserve(state.size());
+    entries_.reserve(state.size());
+    for (boost::unordered_map<std::string, MANIFEST_ENTRY>::const_iterator it = state.begin(); it != state.end(); ++it)
+    {
+        index_[it->first] = entries_.size();
+        paths_.push_back(it->first);
+        entries_.push_back(it->second);
+    }
+    seen_.reset(new boost::atomic<bool>[entries_.size()]);
+    for (size_t i = 0; i < entries_.size(); ++i)
+        seen_[i].store(false, boost::memory_order_relaxed);
+
+    struct stat st;
+    journal_size_ = stat(file_name_.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+const MANIFEST_ENTRY* MANIFEST::find(const std::string& path) const
+{
+    INDEX::const_iterator it = index_.find(path);
+    return it == index_.end() ? NULL : &entries_[it->second];
+}
+
+void MANIFEST::markSeen(const MANIFEST_ENTRY* entry)
+{
+    seen_[entry - &entries_[0]].store(true, boost::memory_order_relaxed);
+}
+
+void MANIFEST::unseen(std::vector<std::pair<std::string, MANIFEST_ENTRY> >& removed) const
+{
+    for (size_t i = 0; i < entries_.size(); ++i)
+        if (!seen_[i].load(boost::memory_order_relaxed))
+            removed.push_back(std::make_pair(paths_[i], entries_[i]));
+}
+
+void MANIFEST::journalEntry(char tag, const std::string& path, const MANIFEST_ENTRY& entry)
+{
+    if (path.find('\n') != std::string::npos)
+    {
+        LOG(WARNING) << "Path with a line break cannot be tracked by the manifest: " << path;
+        return;
+    }
+    std::ostringstream out;
+    appendEntryLine(out, path, entry, tag);
+    journal_ += out.str();
+    changes_[path] = entry;
+}
+
+void MANIFEST::added(const std::string& path, const MANIFEST_ENTRY& entry)
+{
+    journalEntry('+', path, entry);
+}
+
+void MANIFEST::touched(const std::string& path, const MANIFEST_ENTRY& entry)
+{
+    journalEntry('=', path, entry); // the key is not new, a rollback must keep its record
+}
+
+void MANIFEST::removed(const std::string& path, const std::string& key)
+{
+    journal_ += "-\t" + key + "\t" + path + "\n";
+    changes_[path] = MANIFEST_ENTRY(); // tombstone
+}
+
+void MANIFEST::flush()
+{
+    if (journal_.empty())
+        return;
+    int fd = open(file_name_.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0664);
+    CHECK_GE(fd, 0) << "Cannot open " << file_name_;
+    writeWholeFile(fd, journal_, file_name_);
+    close(fd);
+    journal_size_ += journal_.size();
+    journal_.clear();
+}
+
+void MANIFEST::checkpoint(bool complete)
+{
+    std::ostringstream out;
+    out << journal_size_ << ' ' << (complete ? 1 : 0) << '\n';
+    replaceFile(checkpoint_name_, out.str());
+}
+
+void MANIFEST::compact()
+{
+    flush();
+
+    std::ostringstream out;
+    for (size_t i = 0; i < entries_.size(); ++i)
+        if (changes_.find(paths_[i]) == changes_.end())
+            appendEntryLine(out, paths_[i], entries_[i]);
+    for (boost::unordered_map<std::string, MANIFEST_ENTRY>::const_iterator it = changes_.begin(); it != changes_.end(); ++it)
+        if (!it->second.key.empty())
+            appendEntryLine(out, it->first, it->second);
+
+    replaceFile(file_name_, out.str());
+    journal_size_ = out.str().size();
+    checkpoint(true);
+}
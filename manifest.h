@@ -0,0 +1,94 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/unordered_map.hpp>
+#include <stdint.h>
+
+#define MANIFEST_FILE_NAME "manifest"
+#define CHECKPOINT_FILE_NAME "checkpoint"
+
+struct MANIFEST_ENTRY // what a record was made from
+{
+    std::string key;  // lmdb key of the record
+    uint64_t size;    // source file size
+    int64_t mtime;    // source modification time, nanoseconds
+    uint64_t hash;    // hash of the source file contents, 0 - not computed
+
+    MANIFEST_ENTRY() : size(0), mtime(0), hash(0) {}
+};
+
+uint64_t hashFileContents(const void* data, size_t size);
+
+// Source file -> record bookkeeping kept next to an lmdb (<db>/manifest), so
+// a rerun converts only new and changed files and drops records of deleted
+// ones. Paths are relative to the converted directory.
+// On disk the manifest is an append-only journal of text lines:
+//   +<TAB>key<TAB>size<TAB>mtime<TAB>hash<TAB>path   record added
+//   =<TAB>key<TAB>size<TAB>mtime<TAB>hash<TAB>path   entry of an unchanged record refreshed
+//   -<TAB>key<TAB>path                             record removed
+// replayed in order on load, and compacted at the end of a run.
+// The journal is written ahead of every lmdb commit, and after the commit
+// <db>/checkpoint is replaced with the journal length, so lines past the
+// checkpoint describe a transaction that may or may not have made it. A
+// resumed run deletes the keys those lines added and cuts them off, which
+// leaves the database and the manifest in the state of the last checkpoint;
+// the files converted after it are then found changed and converted again.
+// The state loaded at start is read-only during the run, so lookups from
+// pipeline threads need no locking; changes are made by the lmdb writer
+// thread only.
+class MANIFEST
+{
+public:
+    explicit MANIFEST(const std::string& db_path);
+
+    bool exists() const;
+    void create();  // empty journal for a new database
+    void load();
+
+    // crash recovery, before load()
+    bool interrupted() const; // the last run has not finished
+    void uncommitted(std::vector<std::string>& keys) const; // keys added past the checkpoint
+    void rollback();          // cuts the journal back to the checkpoint
+
+    // lookups, any thread
+    const MANIFEST_ENTRY* find(const std::string& path) const;
+    void markSeen(const MANIFEST_ENTRY* entry); // source file still exists
+    size_t size() const { return entries_.size(); }
+
+    // after the scan: entries whose source file was not found
+    void unseen(std::vector<std::pair<std::string, MANIFEST_ENTRY> >& removed) const;
+
+    // writer thread only
+    void added(const std::string& path, const MANIFEST_ENTRY& entry);
+    void touched(const std::string& path, const MANIFEST_ENTRY& entry);
+    void removed(const std::string& path, const std::string& key);
+    void flush();   // appends pending journal lines to the file and syncs it, before the commit
+    void checkpoint(bool complete); // records the journal length, after the commit
+    void compact(); // rewrites the journal with the live entries only, after checkpoint(true)
+
+private:
+    typedef boost::unordered_map<std::string, size_t> INDEX;
+
+    void journalEntry(char tag, const std::string& path, const MANIFEST_ENTRY& entry);
+    bool readCheckpoint(uint64_t& journal_size, bool& complete) const;
+
+    std::string file_name_, checkpoint_name_;
+    uint64_t journal_size_; // bytes of the journal file written so far
+    std::vector<std::string> paths_;
+    std::vector<MANIFEST_ENTRY> entries_;           // state loaded at start
+    INDEX index_;                                   // path -> position in entries_
+    boost::scoped_array<boost::atomic<bool> > seen_;
+
+    boost::unordered_map<std::string, MANIFEST_ENTRY> changes_; // made during the run, empty key - removed
+    std::string journal_;                                       // lines waiting for flush()
+
+    MANIFEST(const MANIFEST&);
+    MANIFEST& operator=(const MANIFEST&);
+};
+
+#endif // MANIFEST_H
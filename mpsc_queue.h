@@ -0,0 +1,72 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <boost/atomic.hpp>
+
+// Intrusive lock-free multi-producer single-consumer queue (D. Vyukov).
+// T must have a member `boost::atomic<T*> next` and be default constructible
+// (one instance is used as the stub node). push() is wait-free and may be
+// called from any thread, pop() must be called from the single consumer only.
+// pop() may return NULL while a producer is half way through push(); the
+// item becomes visible as soon as that push completes.
+template <class T>
+class MPSC_QUEUE
+{
+public:
+    MPSC_QUEUE() : head_(&stub_), tail_(&stub_)
+    {
+        stub_.next.store(NULL, boost::memory_order_relaxed);
+    }
+
+    void push(T* item)
+    {
+        item->next.store(NULL, boost::memory_order_relaxed);
+        T* prev = head_.exchange(item, boost::memory_order_acq_rel);
+        prev->next.store(item, boost::memory_order_release);
+    }
+
+    T* pop()
+    {
+        T* tail = tail_;
+        T* next = tail->next.load(boost::memory_order_acquire);
+        if (tail == &stub_)
+        {
+            if (!next)
+                return NULL;
+            tail_ = next;
+            tail = next;
+            next = next->next.load(boost::memory_order_acquire);
+        }
+        if (next)
+        {
+            tail_ = next;
+            return tail;
+        }
+        if (tail != head_.load(boost::memory_order_acquire))
+            return NULL; // producer has not linked its item yet
+        push(&stub_);
+        next = tail->next.load(boost::memory_order_acquire);
+        if (next)
+        {
+            tail_ = next;
+            return tail;
+        }
+        return NULL;
+    }
+
+    bool empty() const // approximate, consumer side only
+    {
+        return tail_ == &stub_ ? stub_.next.load(boost::memory_order_acquire) == NULL : false;
+    }
+
+private:
+    boost::atomic<T*> head_;
+    char pad_[64];  // keep producers' and consumer's ends on different cache lines
+    T* tail_;
+    T stub_;
+
+    MPSC_QUEUE(const MPSC_QUEUE&);
+    MPSC_QUEUE& operator=(const MPSC_QUEUE&);
+};
+
+#endif // MPSC_QUEUE_H
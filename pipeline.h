@@ -0,0 +1,123 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include "bounded_queue.h"
+
+// Free list of pipeline items. Recycled items keep their buffers, so once
+// the pipeline is warm, files flow through it without heap allocations.
+// Every item is released once it has left the pipeline, so released()
+// counts the items done with.
+template <class T>
+class OBJECT_POOL
+{
+public:
+    OBJECT_POOL() : released_(0) {}
+    ~OBJECT_POOL()
+    {
+        for (size_t i = 0; i < free_.size(); ++i)
+            delete free_[i];
+    }
+
+    T* acquire()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mtx_);
+            if (!free_.empty())
+            {
+                T* item = free_.back();
+                free_.pop_back();
+                return item;
+            }
+        }
+        return new T();
+    }
+
+    void release(T* item)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mtx_);
+            free_.push_back(item);
+        }
+        released_.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    size_t released() const { return released_.load(boost::memory_order_relaxed); }
+
+private:
+    std::vector<T*> free_;
+    boost::mutex mtx_;
+    boost::atomic<size_t> released_;
+
+    OBJECT_POOL(const OBJECT_POOL&);
+    OBJECT_POOL& operator=(const OBJECT_POOL&);
+};
+
+// One stage of the conversion pipeline: a group of workers taking items
+// from the input queue, running the handler on them and passing the
+// survivors to the output queue. Items travel by pointer and the stage owns
+// the item while the handler runs: when the handler returns false (item is
+// rejected) or the stage is the last one, the item is returned to the pool
+// (or deleted if the stage has none).
+// The output queue is closed when the last worker of the stage exits, so
+// closing the first queue shuts the whole pipeline down in order.
+template <class T>
+class PIPELINE_STAGE
+{
+public:
+    typedef BOUNDED_QUEUE<T*> Queue;
+    typedef boost::function<bool(T*)> Handler;
+
+    PIPELINE_STAGE(const std::string& name, Queue* input, Queue* output,
+                   size_t workers_number, const Handler& handler, OBJECT_POOL<T>* pool = NULL) :
+        name_(name), input_(input), output_(output), handler_(handler), pool_(pool),
+        running_(workers_number ? workers_number : 1)
+    {
+        size_t n = running_.load();
+        for (size_t i = 0; i < n; ++i)
+            workers_.create_thread(boost::bind(&PIPELINE_STAGE::workerLoop, this));
+    }
+
+    ~PIPELINE_STAGE() { join(); }
+
+    void join() { workers_.join_all(); }
+    const std::string& name() const { return name_; }
+    size_t size() const { return workers_.size(); }
+
+private:
+    void workerLoop()
+    {
+        T* item;
+        while (input_->pop(item))
+        {
+            if (!handler_(item) || !output_ || !output_->push(item))
+            {
+                if (pool_)
+                    pool_->release(item);
+                else
+                    delete item;
+            }
+        }
+        if (running_.fetch_sub(1) == 1 && output_) // last worker of the stage
+            output_->close();
+    }
+
+    std::string name_;
+    Queue *input_, *output_;
+    Handler handler_;
+    OBJECT_POOL<T>* pool_;
+    boost::atomic<size_t> running_;
+    boost::thread_group workers_;
+
+    PIPELINE_STAGE(const PIPELINE_STAGE&);
+    PIPELINE_STAGE& operator=(const PIPELINE_STAGE&);
+};
+
+#endif // PIPELINE_H
@@ -0,0 +1,94 @@
+#include "progress_reporter.h"
+
+#include <cstdio>
+#include <sstream>
+
+#include <boost/bind.hpp>
+#include <glog/logging.h>
+
+#include "stage_timer.h"
+
+std::string formatSeconds(double seconds)
+{
+    unsigned long total = seconds > 0 ? static_cast<unsigned long>(seconds + 0.5) : 0;
+    char text[32];
+    if (total >= 3600)
+        snprintf(text, sizeof(text), "%luh %02lum %02lus", total/3600, total/60%60, total%60);
+    else if (total >= 60)
+        snprintf(text, sizeof(text), "%lum %02lus", total/60, total%60);
+    else
+        snprintf(text, sizeof(text), "%lus", total);
+    return text;
+}
+
+PROGRESS_REPORTER::PROGRESS_REPORTER(unsigned seconds, const Sampler& sampler) :
+    sampler_(sampler), started_(monotonicNanoseconds())
+{
+    if (seconds)
+        thread_ = boost::thread(boost::bind(&PROGRESS_REPORTER::reportLoop, this, seconds));
+}
+
+PROGRESS_REPORTER::~PROGRESS_REPORTER()
+{
+    if (thread_.joinable())
+    {
+        thread_.interrupt();
+        thread_.join();
+    }
+    PROGRESS_SAMPLE start, end;
+    sampler_(end);
+    report(end, start, (monotonicNanoseconds() - started_)*1e-9, (monotonicNanoseconds() - started_)*1e-9);
+}
+
+void PROGRESS_REPORTER::reportLoop(unsigned seconds)
+{
+    PROGRESS_SAMPLE before, now;
+    uint64_t last = started_;
+    try
+    {
+        for (;;)
+        {
+            boost::this_thread::sleep(boost::posix_time::seconds(seconds)); // interruption point
+            sampler_(now);
+            uint64_t time = monotonicNanoseconds();
+            report(now, before, (time - last)*1e-9, (time - started_)*1e-9);
+            before = now;
+            last = time;
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+    }
+}
+
+void PROGRESS_REPORTER::report(const PROGRESS_SAMPLE& now, const PROGRESS_SAMPLE& before, double interval,
+                               double elapsed) const
+{
+    if (interval <= 0 || elapsed <= 0)
+        return;
+    double rate = (now.files_done - before.files_done)/interval;
+    double average = now.files_done/elapsed;
+
+    std::ostringstream line;
+    line.setf(std::ios::fixed);
+    line.precision(1);
+    line << "Progress: " << now.files_done << " of ";
+    if (now.scan_finished)
+        line << now.files_found << " files ("
+             << (now.files_found ? 100.0*now.files_done/now.files_found : 100.0) << "%)";
+    else
+        line << "at least " << now.files_found << " files, scan in progress";
+    line << ", " << rate << " img/s now, " << average << " img/s average, "
+         << (now.bytes_read - before.bytes_read)/interval/(1 << 20) << " MB/s read, "
+         << now.records_written << " records written";
+    if (!now.queues.empty())
+    {
+        line << ", queues";
+        for (size_t i = 0; i < now.queues.size(); ++i)
+            line << " " << now.queues[i].first << " " << now.queues[i].second;
+    }
+    if (now.scan_finished && now.files_done < now.files_found && average > 0)
+        line << ", ETA " << formatSeconds((now.files_found - now.files_done)/average);
+    line << ", elapsed " << formatSeconds(elapsed);
+    LOG(INFO) << line.str() << std::endl;
+}
@@ -0,0 +1,52 @@
+#ifndef PROGRESS_REPORTER_H
+#define PROGRESS_REPORTER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <stdint.h>
+
+struct PROGRESS_SAMPLE // state of the conversion at one moment
+{
+    uint64_t files_found;    // bmp files the scan has handed to the pipeline
+    bool scan_finished;      // files_found is final
+    uint64_t files_done;     // files out of the pipeline: written, unchanged or dropped
+    uint64_t records_written; // records stored by the writers, a file may go to several databases
+    uint64_t bytes_read;
+    std::vector< std::pair<std::string, size_t> > queues; // name and depth
+
+    PROGRESS_SAMPLE() : files_found(0), scan_finished(false), files_done(0), records_written(0), bytes_read(0) {}
+};
+
+// Logs the progress of the conversion every `seconds` from its own thread:
+// files done out of files found, images per second over the last interval
+// and since the start, MB per second read, records written, queue depths
+// and the time left. Workers only bump relaxed atomic counters, the sampler
+// reads them (and the queue sizes) here, so no worker ever formats a log
+// line. A last summary is logged when the reporter is destroyed.
+class PROGRESS_REPORTER
+{
+public:
+    typedef boost::function<void(PROGRESS_SAMPLE&)> Sampler; // called from the reporter thread
+
+    PROGRESS_REPORTER(unsigned seconds, const Sampler& sampler); // 0 - only the summary
+    ~PROGRESS_REPORTER();
+
+private:
+    void reportLoop(unsigned seconds);
+    void report(const PROGRESS_SAMPLE& now, const PROGRESS_SAMPLE& before, double interval, double elapsed) const;
+
+    Sampler sampler_;
+    uint64_t started_; // monotonic nanoseconds
+    boost::thread thread_;
+
+    PROGRESS_REPORTER(const PROGRESS_REPORTER&);
+    PROGRESS_REPORTER& operator=(const PROGRESS_REPORTER&);
+};
+
+std::string formatSeconds(double seconds); // 1h 02m 03s
+
+#endif // PROGRESS_REPORTER_H
@@ -0,0 +1,184 @@
+#include "resample.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Fills taps for mapping `side` canvas pixels to `out_size` output pixels.
+// The canvas is square, so one table serves both axes.
+static void computeTaps(int side, int out_size, RESAMPLE_TAPS& taps)
+{
+    if (taps.side == side && taps.out_size == out_size) // same scale as the previous image
+        return;
+    taps.side = side;
+    taps.out_size = out_size;
+    taps.first.resize(out_size);
+    taps.count.resize(out_size);
+    taps.offset.resize(out_size);
+    taps.weights.clear(); // keeps capacity
+
+    double scale = static_cast<double>(side) / out_size;
+    for (int o = 0; o < out_size; ++o)
+    {
+        taps.offset[o] = static_cast<int>(taps.weights.size());
+        if (scale >= 1.) // shrinking: average of the covered area
+        {
+            double from = o*scale, to = (o + 1)*scale;
+            int k0 = static_cast<int>(std::floor(from));
+            int k1 = static_cast<int>(std::ceil(to)) - 1;
+            if (k1 > side - 1)
+                k1 = side - 1;
+            taps.first[o] = k0;
+            for (int k = k0; k <= k1; ++k)
+            {
+                double covered = std::min(to, k + 1.) - std::max(from, static_cast<double>(k));
+                taps.weights.push_back(static_cast<float>(covered / scale));
+            }
+            taps.count[o] = k1 - k0 + 1;
+        }
+        else // enlarging: bilinear between the two nearest pixels
+        {
+            double center = (o + 0.5)*scale - 0.5;
+            int k0 = static_cast<int>(std::floor(center));
+            float frac = static_cast<float>(center - k0);
+            if (k0 < 0)
+            {
+                k0 = 0;
+                frac = 0;
+            }
+            if (k0 >= side - 1)
+            {
+                k0 = side - 1;
+                frac = 0;
+            }
+            taps.first[o] = k0;
+            taps.weights.push_back(1.f - frac);
+            taps.count[o] = 1;
+            if (frac > 0)
+            {
+                taps.weights.push_back(frac);
+                taps.count[o] = 2;
+            }
+        }
+    }
+}
+
+// Taps of every output pixel that fall on [start, start + length) of the
+// canvas, numbered from start.
+static void clipTaps(const RESAMPLE_TAPS& taps, int start, int length, CLIPPED_TAPS* clipped)
+{
+    for (int o = 0; o < taps.out_size; ++o)
+    {
+        int k0 = std::max(taps.first[o], start);
+        int k1 = std::min(taps.first[o] + taps.count[o], start + length);
+        clipped[o].first = k0 - start;
+        clipped[o].count = k1 > k0 ? k1 - k0 : 0;
+        clipped[o].weights = k1 > k0 ? &taps.weights[taps.offset[o] + k0 - taps.first[o]] : NULL;
+    }
+}
+
+// OUT_SIZE > 0 fixes the output size at compile time: the clipped taps and
+// the accumulator of an output row live in arrays of that size and the
+// loops along the output row have a constant trip count, so the compiler
+// can unroll and vectorise them; 0 takes the size from runtime_size and
+// the buffers from the scratch.
+template <int OUT_SIZE>
+static void cropPadResizeKernel(const uchar* src, size_t src_step, const CANVAS_PLACEMENT& p,
+                                int runtime_size, uchar* dst, RESAMPLE_SCRATCH& scratch)
+{
+    const int out_size = OUT_SIZE > 0 ? OUT_SIZE : runtime_size;
+    RESAMPLE_TAPS& taps = scratch.taps;
+    computeTaps(p.side, out_size, taps);
+
+    const int fixed_size = OUT_SIZE > 0 ? OUT_SIZE : 1;
+    CLIPPED_TAPS fixed_x[fixed_size], fixed_y[fixed_size];
+    float fixed_sums[fixed_size];
+    if (OUT_SIZE == 0)
+    {
+        if (scratch.clipped.size() < 2*static_cast<size_t>(out_size))
+            scratch.clipped.resize(2*static_cast<size_t>(out_size));
+        if (scratch.sums.size() < static_cast<size_t>(out_size))
+            scratch.sums.resize(out_size);
+    }
+    CLIPPED_TAPS* x_taps = OUT_SIZE > 0 ? fixed_x : &scratch.clipped[0];
+    CLIPPED_TAPS* y_taps = OUT_SIZE > 0 ? fixed_y : &scratch.clipped[out_size];
+    float* sums = OUT_SIZE > 0 ? fixed_sums : &scratch.sums[0];
+    clipTaps(taps, p.x, p.width, x_taps);
+    clipTaps(taps, p.y, p.height, y_taps);
+
+    // horizontal pass over the canvas rows holding the character, the rest is zero
+    if (scratch.rows.size() < static_cast<size_t>(p.height)*out_size)
+        scratch.rows.resize(static_cast<size_t>(p.height)*out_size);
+    for (int r = 0; r < p.height; ++r)
+    {
+        const uchar* src_row = src + (p.src_y + r)*src_step + p.src_x;
+        float* row = &scratch.rows[static_cast<size_t>(r)*out_size];
+        for (int o = 0; o < out_size; ++o)
+        {
+            const uchar* s = src_row + x_taps[o].first;
+            const float* w = x_taps[o].weights;
+            float sum = 0;
+            for (int j = 0; j < x_taps[o].count; ++j)
+                sum += w[j]*s[j];
+            row[o] = sum;
+        }
+    }
+
+    // vertical pass, a whole output row at a time, straight into the destination
+    for (int o = 0; o < out_size; ++o)
+    {
+        for (int x = 0; x < out_size; ++x)
+            sums[x] = 0;
+        for (int j = 0; j < y_taps[o].count; ++j)
+        {
+            const float w = y_taps[o].weights[j];
+            const float* row = &scratch.rows[static_cast<size_t>(y_taps[o].first + j)*out_size];
+            for (int x = 0; x < out_size; ++x)
+                sums[x] += w*row[x];
+        }
+        uchar* dst_row = dst + static_cast<size_t>(o)*out_size;
+        for (int x = 0; x < out_size; ++x)
+        {
+            int v = static_cast<int>(sums[x] + 0.5f);
+            dst_row[x] = static_cast<uchar>(v < 0 ? 0 : (v > 255 ? 255 : v));
+        }
+    }
+}
+
+typedef void (*RESAMPLE_KERNEL)(const uchar*, size_t, const CANVAS_PLACEMENT&, int, uchar*, RESAMPLE_SCRATCH&);
+
+static const struct
+{
+    int out_size;
+    RESAMPLE_KERNEL kernel;
+} RESAMPLE_KERNELS[] = // network input sizes in common use
+{
+    {28, cropPadResizeKernel<28>},
+    {32, cropPadResizeKernel<32>},
+    {48, cropPadResizeKernel<48>},
+    {64, cropPadResizeKernel<64>},
+};
+
+static RESAMPLE_KERNEL findKernel(int out_size)
+{
+    for (size_t i = 0; i < sizeof(RESAMPLE_KERNELS)/sizeof(RESAMPLE_KERNELS[0]); ++i)
+        if (RESAMPLE_KERNELS[i].out_size == out_size)
+            return RESAMPLE_KERNELS[i].kernel;
+    return cropPadResizeKernel<0>;
+}
+
+bool resampleKernelIsSpecialised(int out_size)
+{
+    return findKernel(out_size) != cropPadResizeKernel<0>;
+}
+
+void cropPadResize(const uchar* src, size_t src_step, const CANVAS_PLACEMENT& p,
+                   int out_size, uchar* dst, RESAMPLE_SCRATCH& scratch)
+{
+    findKernel(out_size)(src, src_step, p, out_size, dst, scratch);
+}
+
+void cropPadResizeGeneric(const uchar* src, size_t src_step, const CANVAS_PLACEMENT& p,
+                          int out_size, uchar* dst, RESAMPLE_SCRATCH& scratch)
+{
+    cropPadResizeKernel<0>(src, src_step, p, out_size, dst, scratch);
+}
@@ -0,0 +1,60 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <cstddef>
+#include <vector>
+
+typedef unsigned char uchar;
+
+struct CANVAS_PLACEMENT // where the character lands on the black square canvas
+{
+    int side;          // canvas is side x side pixels
+    int x, y;          // top-left corner of the copied region on the canvas
+    int width, height; // size of the copied region
+    int src_x, src_y;  // top-left corner of the copied region in the source image
+};
+
+struct RESAMPLE_TAPS // canvas pixels contributing to every output pixel along one axis
+{
+    std::vector<int> first, count; // per output pixel: first canvas pixel and number of taps
+    std::vector<float> weights;    // count[i] weights per output pixel, packed one after another
+    std::vector<int> offset;       // per output pixel: index of its first weight
+    int side, out_size;            // scale the taps are computed for
+
+    RESAMPLE_TAPS() : side(0), out_size(0) {}
+};
+
+struct CLIPPED_TAPS // taps of one output pixel that fall on the copied region, the padding adds nothing
+{
+    int first, count;     // first tap relative to the region and number of taps, 0 - padding only
+    const float* weights; // into RESAMPLE_TAPS::weights
+};
+
+struct RESAMPLE_SCRATCH // per-thread buffers, only grow, so a warm thread never allocates
+{
+    RESAMPLE_TAPS taps;
+    std::vector<float> rows; // horizontally resampled canvas rows
+    std::vector<CLIPPED_TAPS> clipped; // both axes, for the generic kernel
+    std::vector<float> sums;           // one output row, for the generic kernel
+};
+
+// Equivalent of copying the placed region onto a zeroed canvas and
+// resizing the canvas to out_size x out_size with area interpolation
+// (bilinear when enlarging, as cv::INTER_AREA does), but without the
+// canvas: output pixels are computed straight from the source using
+// precomputed per-axis weights, zero padding is skipped, and the result is
+// written to `dst` (out_size*out_size bytes, dense rows).
+// The taps are clipped to the copied region once per image, so no loop
+// tests whether a tap is padding. Sizes 28, 32, 48 and 64 run kernels
+// compiled for that size, with the clipped taps and the row accumulator in
+// fixed-size arrays and constant trip counts over the output row; any
+// other size runs the generic one. The taps are reused while the canvas
+// side and the output size stay the same.
+void cropPadResize(const uchar* src, size_t src_step, const CANVAS_PLACEMENT& placement,
+                   int out_size, uchar* dst, RESAMPLE_SCRATCH& scratch);
+bool resampleKernelIsSpecialised(int out_size);
+void cropPadResizeGeneric(const uchar* src, size_t src_step, const CANVAS_PLACEMENT& placement,
+                          int out_size, uchar* dst, RESAMPLE_SCRATCH& scratch); // for any size, the reference
+                                                                                // the specialised kernels are tested against
+
+#endif // RESAMPLE_H
@@ -0,0 +1,161 @@
+#include "shard_index.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <boost/shared_ptr.hpp>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char* placementName(SHARD_PLACEMENT placement)
+{
+    return placement == HASH_PLACEMENT ? "hash" : "round_robin";
+}
+
+bool placementFromName(const std::string& name, SHARD_PLACEMENT& placement)
+{
+    if (name == "round_robin")
+        placement = ROUND_ROBIN;
+    else if (name == "hash")
+        placement = HASH_PLACEMENT;
+    else
+        return false;
+    return true;
+}
+
+std::string SHARD_INDEX::shardName(size_t shard)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "shard_%03u", static_cast<unsigned>(shard));
+    return name;
+}
+
+bool SHARD_INDEX::load(const std::string& db_path)
+{
+    std::string file_name = db_path + "/" SHARD_INDEX_FILE_NAME;
+    std::ifstream in(file_name.c_str());
+    if (!in.good())
+        return false;
+
+    std::string tag, value;
+    size_t shards = 0;
+    CHECK(in >> tag >> shards && tag == "shards") << file_name << " is malformed";
+    CHECK(in >> tag >> value && tag == "placement" && placementFromName(value, placement))
+        << file_name << " is malformed";
+    names.clear();
+    records.clear();
+    for (size_t i = 0; i < shards; ++i)
+    {
+        size_t count = 0;
+        CHECK(in >> value >> count) << file_name << " lists less than " << shards << " shards";
+        names.push_back(value);
+        records.push_back(count);
+    }
+    return true;
+}
+
+void SHARD_INDEX::save(const std::string& db_path) const
+{
+    std::ostringstream out;
+    out << "shards\t" << names.size() << '\n'
+        << "placement\t" << placementName(placement) << '\n';
+    for (size_t i = 0; i < names.size(); ++i)
+        out << names[i] << '\t' << (i < records.size() ? records[i] : 0) << '\n';
+
+    std::string file_name = db_path + "/" SHARD_INDEX_FILE_NAME, tmp_name = file_name + ".tmp";
+    std::string data = out.str();
+    int fd = open(tmp_name.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0664);
+    CHECK_GE(fd, 0) << "Cannot open " << tmp_name;
+    CHECK_EQ(write(fd, data.data(), data.size()), static_cast<ssize_t>(data.size())) << "Cannot write " << tmp_name;
+    CHECK_EQ(fsync(fd), 0) << "Cannot sync " << tmp_name;
+    close(fd);
+    CHECK_EQ(rename(tmp_name.c_str(), file_name.c_str()), 0) << "Cannot replace " << file_name;
+}
+
+struct SHARD_READER // read-only cursor over one shard
+{
+    MDB_env* env;
+    MDB_dbi dbi;
+    MDB_txn* txn;
+    MDB_cursor* cursor;
+    bool more;
+
+    explicit SHARD_READER(const std::string& path) : env(NULL), txn(NULL), cursor(NULL), more(false)
+    {
+        CHECK_EQ(mdb_env_create(&env), MDB_SUCCESS) << "mdb_env_create failed";
+        CHECK_EQ(mdb_env_open(env, path.c_str(), MDB_RDONLY, 0664), MDB_SUCCESS)
+            << "mdb_env_open " << path << " failed";
+        CHECK_EQ(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn), MDB_SUCCESS) << "mdb_txn_begin failed";
+        CHECK_EQ(mdb_open(txn, NULL, 0, &dbi), MDB_SUCCESS) << "mdb_open failed";
+        CHECK_EQ(mdb_cursor_open(txn, dbi, &cursor), MDB_SUCCESS) << "mdb_cursor_open failed";
+    }
+    ~SHARD_READER()
+    {
+        mdb_cursor_close(cursor);
+        mdb_txn_abort(txn);
+        mdb_env_close(env);
+    }
+    bool next(MDB_val& key, MDB_val& data, bool first)
+    {
+        more = mdb_cursor_get(cursor, &key, &data, first ? MDB_FIRST : MDB_NEXT) == MDB_SUCCESS;
+        return more;
+    }
+};
+
+size_t mergeShards(const std::string& sharded_path, const std::string& db_path, const WRITER_OPTIONS& options)
+{
+    SHARD_INDEX index;
+    CHECK(index.load(sharded_path)) << sharded_path << " has no " SHARD_INDEX_FILE_NAME ", it is not sharded";
+
+    std::vector<boost::shared_ptr<SHARD_READER> > shards;
+    for (size_t i = 0; i < index.names.size(); ++i)
+        shards.push_back(boost::shared_ptr<SHARD_READER>(new SHARD_READER(sharded_path + "/" + index.names[i])));
+
+    CHECK_EQ(mkdir(db_path.c_str(), 0744), 0) << "mkdir " << db_path << " failed";
+    MDB_env* env;
+    MDB_dbi dbi;
+    MDB_txn* txn;
+    CHECK_EQ(mdb_env_create(&env), MDB_SUCCESS) << "mdb_env_create failed";
+    CHECK_EQ(mdb_env_set_mapsize(env, 1099511627776), MDB_SUCCESS) << "mdb_env_set_mapsize failed"; // 1TB
+    CHECK_EQ(mdb_env_open(env, db_path.c_str(), 0, 0664), MDB_SUCCESS) << "mdb_env_open failed";
+    CHECK_EQ(mdb_txn_begin(env, NULL, 0, &txn), MDB_SUCCESS) << "mdb_txn_begin failed";
+    CHECK_EQ(mdb_open(txn, NULL, 0, &dbi), MDB_SUCCESS) << "mdb_open failed";
+    CHECK_EQ(mdb_txn_commit(txn), MDB_SUCCESS) << "mdb_txn_commit failed";
+
+    WRITER_OPTIONS merge_options(options);
+    merge_options.first_item = 0;
+    merge_options.last_key.clear();
+    merge_options.manifest = NULL; // the merged database is a snapshot, not updated incrementally
+    size_t merged = 0;
+    {
+        LMDB_WRITER writer(env, dbi, merge_options);
+        const int kMaxKeyLength = 10;
+        char key_cstr[kMaxKeyLength];
+        MDB_val key, data;
+        for (size_t i = 0; i < shards.size(); ++i)
+            shards[i]->more = true;
+        for (bool first = true, any = true; any; first = false)
+        {
+            any = false;
+            for (size_t i = 0; i < shards.size(); ++i)
+            {
+                if (!shards[i]->more || !shards[i]->next(key, data, first))
+                    continue;
+                any = true;
+                DB_RECORD* record = new DB_RECORD();
+                snprintf(key_cstr, kMaxKeyLength, "%08d", static_cast<int>(merged));
+                record->key = key_cstr;
+                record->value.assign(static_cast<const char*>(data.mv_data), data.mv_size);
+                record->item_no = merged++;
+                writer.push(record);
+            }
+        }
+        writer.finish();
+    }
+    mdb_close(env, dbi);
+    mdb_env_close(env);
+    return merged;
+}
@@ -0,0 +1,49 @@
+#ifndef SHARD_INDEX_H
+#define SHARD_INDEX_H
+
+#include <string>
+#include <vector>
+
+#include "lmdb_writer.h"
+
+#define SHARD_INDEX_FILE_NAME "shards"
+
+enum SHARD_PLACEMENT
+{
+    ROUND_ROBIN,   // shards take images in turn, sizes stay even
+    HASH_PLACEMENT // shard follows from the file path, a file always lands in the same shard
+};
+
+// Layout of a sharded database: <db> is a directory holding independent
+// lmdb environments <db>/shard_000, <db>/shard_001, ..., each written by
+// its own LMDB_WRITER, and the index <db>/shards, a text file
+//   shards<TAB>N
+//   placement<TAB>round_robin|hash
+//   shard_000<TAB>records
+//   ...
+// Keys are numbered per shard, so every shard is dense and appended in
+// order (unless --key_block leaves gaps); mergeShards() renumbers them
+// when the shards are folded into one database.
+struct SHARD_INDEX
+{
+    SHARD_PLACEMENT placement;
+    std::vector<std::string> names;   // shard directories, relative to <db>
+    std::vector<size_t> records;      // per shard, as of the last save()
+
+    SHARD_INDEX() : placement(ROUND_ROBIN) {}
+
+    bool load(const std::string& db_path); // false - <db> is not sharded
+    void save(const std::string& db_path) const; // atomically
+
+    static std::string shardName(size_t shard);
+};
+
+const char* placementName(SHARD_PLACEMENT placement);
+bool placementFromName(const std::string& name, SHARD_PLACEMENT& placement);
+
+// Folds the shards of `sharded_path` into the new database `db_path`,
+// taking records from the shards in turn (the round-robin order they were
+// dealt in) and numbering them from 0. Returns the number of records.
+size_t mergeShards(const std::string& sharded_path, const std::string& db_path, const WRITER_OPTIONS& options);
+
+#endif // SHARD_INDEX_H
@@ -0,0 +1,189 @@
+#include "stage_timer.h"
+
+#include <iomanip>
+#include <sstream>
+
+#include <boost/bind.hpp>
+#include <glog/logging.h>
+
+#ifdef __linux__
+#include <time.h>
+#else
+#include <boost/date_time/posix_time/posix_time.hpp>
+#endif
+
+static const char* const TIMER_NAMES[TIMER_COUNT] =
+    {"scan", "read", "decode", "blob", "resize", "serialize", "writer_wait", "mdb_put", "commit"};
+
+uint64_t monotonicNanoseconds()
+{
+#ifdef __linux__
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts); // vDSO, no system call
+    return static_cast<uint64_t>(ts.tv_sec)*1000000000 + ts.tv_nsec;
+#else
+    static const boost::posix_time::ptime epoch = boost::posix_time::microsec_clock::universal_time();
+    return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds()*1000 + 1;
+#endif
+}
+
+STAGE_TIMERS::THREAD_HISTOGRAMS::THREAD_HISTOGRAMS()
+{
+    for (int t = 0; t < TIMER_COUNT; ++t)
+    {
+        HISTOGRAM& h = timers[t];
+        for (int b = 0; b < BUCKETS; ++b)
+            h.buckets[b].store(0, boost::memory_order_relaxed);
+        h.sum.store(0, boost::memory_order_relaxed);
+        h.max.store(0, boost::memory_order_relaxed);
+    }
+}
+
+STAGE_TIMERS::STAGE_TIMERS() : enabled_(false), local_(&STAGE_TIMERS::keep)
+{
+}
+
+STAGE_TIMERS& STAGE_TIMERS::instance()
+{
+    static STAGE_TIMERS timers; // first used by main before any thread starts
+    return timers;
+}
+
+size_t STAGE_TIMERS::bucketOf(uint64_t value)
+{
+    if (value < 4)
+        return static_cast<size_t>(value);
+    int octave = 0; // floor(log2(value)), at least 2 here
+#ifdef __GNUC__
+    octave = 63 - __builtin_clzll(value);
+#else
+    for (uint64_t v = value; v > 1; v >>= 1)
+        octave++;
+#endif
+    return 4*(octave - 1) + ((value >> (octave - 2)) & 3);
+}
+
+uint64_t STAGE_TIMERS::bucketValue(size_t bucket)
+{
+    if (bucket < 4)
+        return bucket;
+    int octave = static_cast<int>(bucket/4) + 1;
+    uint64_t width = 1ULL << (octave - 2);
+    return (4 + bucket%4)*width + width/2;
+}
+
+STAGE_TIMERS::THREAD_HISTOGRAMS* STAGE_TIMERS::local()
+{
+    THREAD_HISTOGRAMS* histograms = local_.get();
+    if (!histograms) // first sample of this thread
+    {
+        boost::shared_ptr<THREAD_HISTOGRAMS> created(new THREAD_HISTOGRAMS());
+        {
+            boost::lock_guard<boost::mutex> lock(mtx_);
+            threads_.push_back(created);
+        }
+        histograms = created.get();
+        local_.reset(histograms);
+    }
+    return histograms;
+}
+
+void STAGE_TIMERS::record(STAGE_TIMER_ID id, uint64_t nanoseconds)
+{
+    HISTOGRAM& h = local()->timers[id];
+    // single writer per histogram, plain load and store instead of read-modify-write
+    boost::atomic<uint64_t>& bucket = h.buckets[bucketOf(nanoseconds)];
+    bucket.store(bucket.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+    h.sum.store(h.sum.load(boost::memory_order_relaxed) + nanoseconds, boost::memory_order_relaxed);
+    if (nanoseconds > h.max.load(boost::memory_order_relaxed))
+        h.max.store(nanoseconds, boost::memory_order_relaxed);
+}
+
+static std::string formatDuration(uint64_t nanoseconds)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    if (nanoseconds < 10000)
+        out << nanoseconds << "ns";
+    else if (nanoseconds < 10000000)
+        out << nanoseconds/1000. << "us";
+    else
+        out << nanoseconds/1000000. << "ms";
+    return out.str();
+}
+
+void STAGE_TIMERS::report(const char* when) const
+{
+    std::vector<uint64_t> buckets(BUCKETS);
+    boost::lock_guard<boost::mutex> lock(mtx_);
+    for (int t = 0; t < TIMER_COUNT; ++t)
+    {
+        std::fill(buckets.begin(), buckets.end(), 0);
+        uint64_t count = 0, sum = 0, max = 0;
+        for (size_t i = 0; i < threads_.size(); ++i)
+        {
+            const HISTOGRAM& h = threads_[i]->timers[t];
+            for (int b = 0; b < BUCKETS; ++b)
+                buckets[b] += h.buckets[b].load(boost::memory_order_relaxed);
+            sum += h.sum.load(boost::memory_order_relaxed);
+            uint64_t h_max = h.max.load(boost::memory_order_relaxed);
+            if (h_max > max)
+                max = h_max;
+        }
+        for (int b = 0; b < BUCKETS; ++b) // from the buckets, so the percentiles agree with it
+            count += buckets[b];
+        if (!count)
+            continue;
+
+        uint64_t p50 = 0, p99 = 0, seen = 0;
+        bool half = false;
+        for (int b = 0; b < BUCKETS; ++b)
+        {
+            seen += buckets[b];
+            if (!half && seen*2 >= count)
+            {
+                p50 = bucketValue(b);
+                half = true;
+            }
+            if (seen*100 >= count*99)
+            {
+                p99 = bucketValue(b);
+                break;
+            }
+        }
+        LOG(INFO) << "Timing " << when << ": " << std::left << std::setw(11) << TIMER_NAMES[t]
+                  << " n " << count << ", mean " << formatDuration(sum/count) << ", p50 " << formatDuration(p50)
+                  << ", p99 " << formatDuration(p99) << ", max " << formatDuration(max) << std::endl;
+    }
+}
+
+TIMING_REPORTER::TIMING_REPORTER(unsigned seconds)
+{
+    if (seconds)
+        thread_ = boost::thread(boost::bind(&TIMING_REPORTER::reportLoop, this, seconds));
+}
+
+TIMING_REPORTER::~TIMING_REPORTER()
+{
+    if (thread_.joinable())
+    {
+        thread_.interrupt();
+        thread_.join();
+    }
+    STAGE_TIMERS::instance().report("total");
+}
+
+void TIMING_REPORTER::reportLoop(unsigned seconds)
+{
+    try
+    {
+        for (;;)
+        {
+            boost::this_thread::sleep(boost::posix_time::seconds(seconds)); // interruption point
+            STAGE_TIMERS::instance().report("so far");
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef STAGE_TIMER_H
+#define STAGE_TIMER_H
+
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <stdint.h>
+
+enum STAGE_TIMER_ID
+{
+    TIMER_SCAN,        // getdents64 of one directory block
+    TIMER_READ,        // readFile: manifest lookup, open, read, hash
+    TIMER_DECODE,      // decodeImage
+    TIMER_BLOB,        // placeCharacter: findBlobParams and the canvas geometry
+    TIMER_RESIZE,      // cropPadResize, per output size
+    TIMER_SERIALIZE,   // serializeRecord, including the writer wait
+    TIMER_WRITER_WAIT, // LMDB_WRITER::push held back by a full writer queue
+    TIMER_MDB_PUT,     // mdb_put and the Datum encoding into the reserved page
+    TIMER_COMMIT,      // manifest flush and mdb_txn_commit
+    TIMER_COUNT
+};
+
+uint64_t monotonicNanoseconds();
+
+// Latency histograms of the conversion stages. Every thread records into
+// its own set of histograms, buckets are a quarter of an octave wide
+// (relative error under 13%), so recording is two clock reads and a few
+// uncontended relaxed stores. report() merges the threads' histograms at
+// any time, while they are still being recorded into.
+class STAGE_TIMERS
+{
+public:
+    static STAGE_TIMERS& instance();
+
+    void enable(bool on) { enabled_.store(on, boost::memory_order_relaxed); }
+    bool enabled() const { return enabled_.load(boost::memory_order_relaxed); }
+
+    void record(STAGE_TIMER_ID id, uint64_t nanoseconds); // any thread
+    void report(const char* when) const; // count, mean, p50, p99 and max of every stage to the log
+
+private:
+    enum { BUCKETS = 256 };
+
+    struct HISTOGRAM // written by its thread only
+    {
+        boost::atomic<uint64_t> buckets[BUCKETS];
+        boost::atomic<uint64_t> sum, max; // count is the sum of the buckets
+    };
+
+    struct THREAD_HISTOGRAMS
+    {
+        HISTOGRAM timers[TIMER_COUNT];
+        THREAD_HISTOGRAMS();
+    };
+
+    STAGE_TIMERS();
+    THREAD_HISTOGRAMS* local();
+    static void keep(THREAD_HISTOGRAMS*) {} // histograms outlive their threads
+    static size_t bucketOf(uint64_t value);
+    static uint64_t bucketValue(size_t bucket); // middle of the bucket
+
+    boost::atomic<bool> enabled_;
+    boost::thread_specific_ptr<THREAD_HISTOGRAMS> local_;
+    mutable boost::mutex mtx_;
+    std::vector< boost::shared_ptr<THREAD_HISTOGRAMS> > threads_; // guarded by mtx_
+
+    STAGE_TIMERS(const STAGE_TIMERS&);
+    STAGE_TIMERS& operator=(const STAGE_TIMERS&);
+};
+
+class SCOPED_TIMER // times its own lifetime
+{
+public:
+    explicit SCOPED_TIMER(STAGE_TIMER_ID id) :
+        id_(id), start_(STAGE_TIMERS::instance().enabled() ? monotonicNanoseconds() : 0) {}
+    ~SCOPED_TIMER()
+    {
+        if (start_)
+            STAGE_TIMERS::instance().record(id_, monotonicNanoseconds() - start_);
+    }
+
+private:
+    STAGE_TIMER_ID id_;
+    uint64_t start_; // 0 - timers are off
+
+    SCOPED_TIMER(const SCOPED_TIMER&);
+    SCOPED_TIMER& operator=(const SCOPED_TIMER&);
+};
+
+// Logs the timings every `seconds` from its own thread and once more when
+// it is destroyed, at the end of the conversion.
+class TIMING_REPORTER
+{
+public:
+    explicit TIMING_REPORTER(unsigned seconds);
+    ~TIMING_REPORTER();
+
+private:
+    void reportLoop(unsigned seconds);
+
+    boost::thread thread_;
+
+    TIMING_REPORTER(const TIMING_REPORTER&);
+    TIMING_REPORTER& operator=(const TIMING_REPORTER&);
+};
+
+#endif // STAGE_TIMER_H
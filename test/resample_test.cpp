@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include <stdint.h>
+
+#include "resample.h"
+
+// The kernels specialised for 28, 32, 48 and 64 have to write exactly what
+// the generic kernel writes, for any placement of the character on the
+// canvas: inside it, against each of its edges, filling it, a single pixel,
+// and canvases smaller (enlarging) and larger (shrinking) than the output.
+
+static const int SIZES[] = {28, 32, 48, 64};
+
+class TEST_RNG // splitmix64, the same cases on every platform
+{
+public:
+    explicit TEST_RNG(uint64_t seed) : state_(seed) {}
+    int uniform(int low, int high) // [low, high]
+    {
+        uint64_t z = (state_ += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        return low + static_cast<int>(z % static_cast<uint64_t>(high - low + 1));
+    }
+
+private:
+    uint64_t state_;
+};
+
+enum EDGE // where the copied region lies on the canvas
+{
+    EDGE_ANY,    // anywhere
+    EDGE_LEFT_TOP,
+    EDGE_RIGHT_BOTTOM,
+    EDGE_FILLED, // the whole canvas
+    EDGE_PIXEL,  // a single pixel
+    EDGE_COUNT
+};
+
+static CANVAS_PLACEMENT placeRegion(TEST_RNG& rng, int out_size, EDGE edge, int image_width, int image_height)
+{
+    CANVAS_PLACEMENT p;
+    switch (rng.uniform(0, 2)) // canvas against the output size
+    {
+        case 0:
+            p.side = rng.uniform(1, out_size); // enlarging
+            break;
+        case 1:
+            p.side = out_size + rng.uniform(-1, 1);
+            break;
+        default:
+            p.side = rng.uniform(out_size + 1, 4*out_size); // shrinking
+    }
+    p.side = std::max(p.side, 1);
+    int max_width = std::min(p.side, image_width), max_height = std::min(p.side, image_height);
+    p.width = rng.uniform(1, max_width);
+    p.height = rng.uniform(1, max_height);
+    if (edge == EDGE_PIXEL)
+        p.width = p.height = 1;
+    if (edge == EDGE_FILLED)
+    {
+        p.side = std::min(max_width, max_height);
+        p.width = p.height = p.side;
+    }
+    p.x = rng.uniform(0, p.side - p.width);
+    p.y = rng.uniform(0, p.side - p.height);
+    if (edge == EDGE_LEFT_TOP || edge == EDGE_FILLED)
+        p.x = p.y = 0;
+    if (edge == EDGE_RIGHT_BOTTOM)
+    {
+        p.x = p.side - p.width;
+        p.y = p.side - p.height;
+    }
+    p.src_x = rng.uniform(0, image_width - p.width);
+    p.src_y = rng.uniform(0, image_height - p.height);
+    return p;
+}
+
+int main()
+{
+    TEST_RNG rng(1);
+    RESAMPLE_SCRATCH specialised_scratch, generic_scratch; // shared by all cases, as a preprocess thread does
+    std::vector<uchar> image, specialised, generic;
+    int cases = 0, failures = 0;
+    for (size_t s = 0; s < sizeof(SIZES)/sizeof(SIZES[0]); ++s)
+    {
+        int out_size = SIZES[s];
+        if (!resampleKernelIsSpecialised(out_size))
+        {
+            printf("FAILED: no specialised kernel for %d\n", out_size);
+            return 1;
+        }
+        specialised.resize(out_size*out_size);
+        generic.resize(out_size*out_size);
+        for (int i = 0; i < 2000; ++i)
+        {
+            int width = rng.uniform(1, 160), height = rng.uniform(1, 160);
+            size_t step = width + rng.uniform(0, 7); // rows may be padded
+            image.resize(step*height);
+            for (size_t k = 0; k < image.size(); ++k)
+                image[k] = static_cast<uchar>(rng.uniform(0, 255));
+            CANVAS_PLACEMENT p = placeRegion(rng, out_size, static_cast<EDGE>(i % EDGE_COUNT), width, height);
+
+            std::fill(specialised.begin(), specialised.end(), 0xA5); // every pixel has to be written
+            std::fill(generic.begin(), generic.end(), 0x5A);
+            cropPadResize(&image[0], step, p, out_size, &specialised[0], specialised_scratch);
+            cropPadResizeGeneric(&image[0], step, p, out_size, &generic[0], generic_scratch);
+            cases++;
+            if (specialised != generic)
+            {
+                if (failures++ < 10)
+                    printf("FAILED: %dx%d output, region %dx%d at %d,%d on a %d canvas, from %d,%d of %dx%d\n",
+                           out_size, out_size, p.width, p.height, p.x, p.y, p.side, p.src_x, p.src_y, width, height);
+            }
+        }
+    }
+    printf("%d of %d placements differ between the specialised and the generic kernels\n", failures, cases);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,116 @@
+#include "thread_pool.h"
+
+#include <boost/bind.hpp>
+
+boost::thread_specific_ptr<WORK_STEALING_POOL::WORKER_SLOT> WORK_STEALING_POOL::current_worker_;
+
+WORK_STEALING_POOL::WORK_STEALING_POOL(size_t threads_number) :
+    queued_(0), pending_(0), next_queue_(0), stop_(false)
+{
+    if (threads_number == 0)
+        threads_number = boost::thread::hardware_concurrency();
+    if (threads_number == 0) // hardware_concurrency() is allowed to return 0
+        threads_number = 1;
+
+    for (size_t i = 0; i < threads_number; ++i)
+        queues_.push_back(new WORKER_QUEUE());
+    for (size_t i = 0; i < threads_number; ++i)
+        workers_.create_thread(boost::bind(&WORK_STEALING_POOL::workerLoop, this, i));
+}
+
+WORK_STEALING_POOL::~WORK_STEALING_POOL()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(idle_mtx_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    workers_.join_all();
+    for (size_t i = 0; i < queues_.size(); ++i)
+        delete queues_[i];
+}
+
+void WORK_STEALING_POOL::submit(const Task& task)
+{
+    size_t idx;
+    WORKER_SLOT* slot = current_worker_.get();
+    if (slot && slot->pool == this)
+        idx = slot->idx;  // spawned by a worker - keep it local
+    else
+        idx = next_queue_.fetch_add(1, boost::memory_order_relaxed) % queues_.size();
+
+    pending_.fetch_add(1);
+    {
+        boost::lock_guard<boost::mutex> lock(queues_[idx]->mtx_);
+        queues_[idx]->tasks.push_back(task);
+    }
+    queued_.fetch_add(1);
+
+    boost::lock_guard<boost::mutex> lock(idle_mtx_); // pairs with the check in workerLoop, no lost wake-ups
+    work_cv_.notify_one();
+}
+
+void WORK_STEALING_POOL::wait()
+{
+    boost::unique_lock<boost::mutex> lock(idle_mtx_);
+    while (pending_.load() != 0)
+        done_cv_.wait(lock);
+}
+
+bool WORK_STEALING_POOL::popLocal(size_t worker_idx, Task& task)
+{
+    WORKER_QUEUE* q = queues_[worker_idx];
+    boost::lock_guard<boost::mutex> lock(q->mtx_);
+    if (q->tasks.empty())
+        return false;
+    task.swap(q->tasks.back());
+    q->tasks.pop_back();
+    return true;
+}
+
+bool WORK_STEALING_POOL::steal(size_t worker_idx, Task& task)
+{
+    for (size_t i = 1; i < queues_.size(); ++i)
+    {
+        WORKER_QUEUE* q = queues_[(worker_idx + i) % queues_.size()];
+        boost::unique_lock<boost::mutex> lock(q->mtx_, boost::try_to_lock);
+        if (!lock.owns_lock() || q->tasks.empty()) // busy victim - try the next one
+            continue;
+        task.swap(q->tasks.front());
+        q->tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void WORK_STEALING_POOL::workerLoop(size_t worker_idx)
+{
+    WORKER_SLOT* slot = new WORKER_SLOT();
+    slot->pool = this;
+    slot->idx = worker_idx;
+    current_worker_.reset(slot);
+
+    Task task;
+    for (;;)
+    {
+        if (popLocal(worker_idx, task) || steal(worker_idx, task))
+        {
+            queued_.fetch_sub(1);
+            task();
+            task.clear();
+            if (pending_.fetch_sub(1) == 1)
+            {
+                boost::lock_guard<boost::mutex> lock(idle_mtx_);
+                done_cv_.notify_all();
+            }
+            continue;
+        }
+
+        boost::unique_lock<boost::mutex> lock(idle_mtx_);
+        if (queued_.load() != 0) // somebody holds a task we failed to steal, retry
+            continue;
+        if (stop_)
+            break;
+        work_cv_.wait(lock);
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <deque>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+// Pool of worker threads with one task deque per worker.
+// A worker pops the newest task from its own deque (LIFO keeps caches warm)
+// and, when the deque is empty, steals the oldest task from another worker.
+// Tasks submitted from a worker thread go to that worker's deque, so
+// a directory walk that spawns per-file tasks spreads itself over all cores.
+class WORK_STEALING_POOL
+{
+public:
+    typedef boost::function<void()> Task;
+
+    explicit WORK_STEALING_POOL(size_t threads_number = 0); // 0 - one thread per hardware thread
+    ~WORK_STEALING_POOL();
+
+    void submit(const Task& task);
+    void wait(); // blocks until every submitted task (and tasks spawned by them) is finished
+    size_t size() const { return queues_.size(); }
+
+private:
+    struct WORKER_QUEUE
+    {
+        boost::mutex mtx_;
+        std::deque<Task> tasks;
+    };
+
+    struct WORKER_SLOT // identifies the pool worker running on the current thread
+    {
+        WORK_STEALING_POOL* pool;
+        size_t idx;
+    };
+
+    void workerLoop(size_t worker_idx);
+    bool popLocal(size_t worker_idx, Task& task);
+    bool steal(size_t worker_idx, Task& task);
+
+    std::vector<WORKER_QUEUE*> queues_;
+    boost::thread_group workers_;
+
+    boost::atomic<size_t> queued_;   // tasks sitting in the deques
+    boost::atomic<size_t> pending_;  // tasks submitted but not finished yet
+    boost::atomic<size_t> next_queue_; // round-robin slot for external submissions
+    bool stop_;
+
+    boost::mutex idle_mtx_;
+    boost::condition_variable work_cv_, done_cv_;
+
+    static boost::thread_specific_ptr<WORKER_SLOT> current_worker_;
+
+    WORK_STEALING_POOL(const WORK_STEALING_POOL&);
+    WORK_STEALING_POOL& operator=(const WORK_STEALING_POOL&);
+};
+
+#endif // THREAD_POOL_H